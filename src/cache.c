@@ -0,0 +1,275 @@
+/*
+ * This implements a memory bounded LRU cache which
+ * keeps decoded sources and scaled tiles resident
+ * between jobs.
+ *
+ * Author: Michael Dushkoff (mad1841@rit.edu)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <png.h>
+#include "cache.h"
+
+// FNV-1a hashing constants
+#define FNV_OFFSET (14695981039346656037ULL)
+#define FNV_PRIME (1099511628211ULL)
+
+/*
+ * This unlinks an entry from the recency list.
+ *
+ * Inputs:
+ *     cache - The cache (modified)
+ *     e - The entry to unlink
+ */
+static void unlink_entry(image_cache *cache, cache_entry *e){
+    if ((*e).prev){
+        (*(*e).prev).next = (*e).next;
+    }
+    else{
+        (*cache).head = (*e).next;
+    }
+    if ((*e).next){
+        (*(*e).next).prev = (*e).prev;
+    }
+    else{
+        (*cache).tail = (*e).prev;
+    }
+    (*e).prev = NULL;
+    (*e).next = NULL;
+}
+
+/*
+ * This links an entry in as the most recently used.
+ *
+ * Inputs:
+ *     cache - The cache (modified)
+ *     e - The entry to link
+ */
+static void push_front(image_cache *cache, cache_entry *e){
+    (*e).prev = NULL;
+    (*e).next = (*cache).head;
+    if ((*cache).head){
+        (*(*cache).head).prev = e;
+    }
+    (*cache).head = e;
+    if (!(*cache).tail){
+        (*cache).tail = e;
+    }
+}
+
+/*
+ * This evicts least recently used entries which are not
+ * in use until the cache fits within its capacity.
+ *
+ * Inputs:
+ *     cache - The cache (modified)
+ */
+static void evict(image_cache *cache){
+    cache_entry *e = (*cache).tail;
+    cache_entry *prev;
+
+    while (e && (*cache).bytes > (*cache).capacity){
+        prev = (*e).prev;
+        if ((*e).refs == 0){
+            unlink_entry(cache,e);
+            (*cache).bytes -= (*e).bytes;
+            (*cache).evictions++;
+            dealloc_image(&(*e).img);
+            free(e);
+        }
+        e = prev;
+    }
+}
+
+/*
+ * This initializes an empty cache.
+ *
+ * Inputs:
+ *     cache - The cache (modified)
+ *     capacity - The maximum number of bytes of image data to keep
+ */
+void cache_init(image_cache *cache, size_t capacity){
+    int k;
+
+    (*cache).head = NULL;
+    (*cache).tail = NULL;
+    (*cache).bytes = 0;
+    (*cache).capacity = capacity;
+    for (k=0; k<CACHE_KINDS; k++){
+        (*cache).hits[k] = 0;
+        (*cache).misses[k] = 0;
+    }
+    (*cache).evictions = 0;
+}
+
+/*
+ * This deallocates every entry in a cache.
+ *
+ * Inputs:
+ *     cache - The cache (modified)
+ */
+void cache_destroy(image_cache *cache){
+    cache_entry *e = (*cache).head;
+    cache_entry *next;
+
+    while (e){
+        next = (*e).next;
+        dealloc_image(&(*e).img);
+        free(e);
+        e = next;
+    }
+    (*cache).head = NULL;
+    (*cache).tail = NULL;
+    (*cache).bytes = 0;
+}
+
+/*
+ * This looks up an image in the cache.  A found image is
+ * marked as in use until it is given to cache_release.
+ * The cache holds few (but large) entries so a linear
+ * search is sufficient.
+ *
+ * Inputs:
+ *     cache - The cache (modified)
+ *     kind - The kind of image
+ *     hash - The source file content hash
+ *     height - The tile height (0 for sources)
+ *     width - The tile width (0 for sources)
+ * Outputs:
+ *     img - The cached image or NULL on a miss
+ */
+image_f *cache_get(image_cache *cache, cache_kind kind, unsigned long long hash, int height, int width){
+    cache_entry *e;
+
+    for (e=(*cache).head; e; e=(*e).next){
+        if ((*e).kind == kind && (*e).hash == hash &&
+            (*e).height == height && (*e).width == width){
+            unlink_entry(cache,e);
+            push_front(cache,e);
+            (*e).refs++;
+            (*cache).hits[kind]++;
+            return &(*e).img;
+        }
+    }
+    (*cache).misses[kind]++;
+    return NULL;
+}
+
+/*
+ * This inserts an image into the cache, taking ownership of
+ * its data.  The inserted image is marked as in use until it
+ * is given to cache_release.
+ *
+ * Inputs:
+ *     cache - The cache (modified)
+ *     kind - The kind of image
+ *     hash - The source file content hash
+ *     height - The tile height (0 for sources)
+ *     width - The tile width (0 for sources)
+ *     img - The image to insert
+ * Outputs:
+ *     img - The cached image
+ */
+image_f *cache_put(image_cache *cache, cache_kind kind, unsigned long long hash, int height, int width, image_f img){
+    cache_entry *e = (cache_entry*)malloc(sizeof(cache_entry));
+
+    if (!e){
+        perror_("ERROR: Cache entry allocation failed.");
+    }
+    (*e).kind = kind;
+    (*e).hash = hash;
+    (*e).height = height;
+    (*e).width = width;
+    (*e).img = img;
+    (*e).bytes = sizeof(float)*img.height*img.width*img.depth;
+    (*e).refs = 1;
+    push_front(cache,e);
+    (*cache).bytes += (*e).bytes;
+
+    // Make room for the new entry
+    evict(cache);
+
+    return &(*e).img;
+}
+
+/*
+ * This marks an image obtained from the cache as no longer
+ * in use, allowing it to be evicted.
+ *
+ * Inputs:
+ *     cache - The cache (modified)
+ *     img - The cached image
+ */
+void cache_release(image_cache *cache, image_f *img){
+    cache_entry *e;
+
+    for (e=(*cache).head; e; e=(*e).next){
+        if (&(*e).img == img){
+            (*e).refs--;
+            break;
+        }
+    }
+    evict(cache);
+}
+
+/*
+ * This calculates the hit rate of a cache.
+ *
+ * Inputs:
+ *     cache - The cache
+ *     kind - The kind of image (or CACHE_KINDS for all kinds)
+ * Outputs:
+ *     rate - The hit rate in the range [0,1]
+ */
+float cache_hitRate(image_cache *cache, int kind){
+    unsigned long hits = 0;
+    unsigned long total = 0;
+    int k;
+
+    for (k=0; k<CACHE_KINDS; k++){
+        if (kind == CACHE_KINDS || kind == k){
+            hits += (*cache).hits[k];
+            total += (*cache).hits[k]+(*cache).misses[k];
+        }
+    }
+    return total > 0 ? (float)hits/(float)total : 0.0;
+}
+
+/*
+ * This calculates a 64-bit FNV-1a hash of a PNG file's
+ * contents, which identifies it regardless of its name.
+ *
+ * Inputs:
+ *     hash - The content hash (modified)
+ *     filename - The name of the PNG file
+ * Outputs:
+ *     ret - 0 on success, -1 if the file is unreadable or not a PNG
+ */
+int hash_file(unsigned long long *hash, char *filename){
+    unsigned char buf[65536]; // Read buffer
+    size_t n,i;               // Read size and iterator
+    int first = 1;            // Whether the header is being read
+    FILE *fp = fopen(filename,"rb");
+
+    // Check for NULL file pointer
+    if (!fp){
+        return -1;
+    }
+
+    *hash = FNV_OFFSET;
+    while ((n = fread(buf,1,sizeof(buf),fp)) > 0){
+        // Check for valid PNG file
+        if (first && (n < 8 || png_sig_cmp(buf,0,8))){
+            fclose(fp);
+            return -1;
+        }
+        first = 0;
+        for (i=0; i<n; i++){
+            *hash = (*hash ^ buf[i])*FNV_PRIME;
+        }
+    }
+    fclose(fp);
+
+    return first ? -1 : 0;
+}
@@ -0,0 +1,54 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * *
+ * Predefinitions of a memory bounded LRU cache of
+ * decoded source images and scaled tiles.
+ *
+ * Author: Michael Dushkoff (mad1841@rit.edu)
+ * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stddef.h>
+#include "image.h"
+
+// CACHE_H_
+#ifndef CACHE_H_
+#define CACHE_H_
+
+/**** Cached image kind enumeration ****/
+typedef enum{
+    CACHE_SOURCE,
+    CACHE_TILE,
+    CACHE_KINDS
+} cache_kind;
+
+/**** Structure declarations ****/
+typedef struct cache_entry{
+    cache_kind kind;
+    unsigned long long hash; // Content hash of the source file
+    int height;              // Tile height (0 for sources)
+    int width;               // Tile width (0 for sources)
+    image_f img;
+    size_t bytes;
+    int refs;                // Entries in use are never evicted
+    struct cache_entry *prev;
+    struct cache_entry *next;
+} cache_entry;
+
+typedef struct{
+    cache_entry *head;       // Most recently used
+    cache_entry *tail;       // Least recently used
+    size_t bytes;
+    size_t capacity;
+    unsigned long hits[CACHE_KINDS];
+    unsigned long misses[CACHE_KINDS];
+    unsigned long evictions;
+} image_cache;
+
+/**** Cache operations ****/
+void cache_init(image_cache *cache, size_t capacity);
+void cache_destroy(image_cache *cache);
+image_f *cache_get(image_cache *cache, cache_kind kind, unsigned long long hash, int height, int width);
+image_f *cache_put(image_cache *cache, cache_kind kind, unsigned long long hash, int height, int width, image_f img);
+void cache_release(image_cache *cache, image_f *img);
+float cache_hitRate(image_cache *cache, int kind);
+int hash_file(unsigned long long *hash, char *filename);
+
+#endif // END CACHE_H_
@@ -8,6 +8,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <png.h>
 #include <math.h>
 #include "image.h"
@@ -41,19 +42,35 @@ void dealloc_image(image_f *img){
 }
 
 /*
- * Reads a PNG file into a struct.
+ * This reports a PNG error and aborts.
  *
  * Inputs:
+ *     err - The reason for the failure
+ */
+static void png_abort(const char *err){
+    char msg[256]; // Prefixed message
+
+    snprintf(msg,sizeof(msg),"ERROR: %s",err);
+    perror_(msg);
+}
+
+/*
+ * Reads a PNG file into a struct without aborting on failure,
+ * so that long running callers (e.g. the server) can report
+ * the error and carry on.
+ *
+ * Inputs:
+ *     out - The output image (modified)
  *     filename - The name of the PNG file
+ *     err - The reason for any failure (modified)
  * Outputs:
- *     out - The png_structp of the inputted file
+ *     ret - 0 on success, -1 on failure
  */
-image_f read_png(char *filename){
+int load_png(image_f *out, char *filename, const char **err){
     int w, h, d;             // Boundaries
     int row, col, dep;       // Iterators
     png_byte color_type;     // Determines number of channels
-    //png_byte bit_depth;      // Number of bits per color
-    image_f out;             // Output image
+    png_byte bit_depth;      // Number of bits per color
     png_structp pngP;        // PNG data pointer
     png_infop info_ptr;      // PNG info pointer
     unsigned char header[8]; // Header is a maximum of 8 bytes
@@ -64,13 +81,15 @@ image_f read_png(char *filename){
 
     // Check for NULL file pointer
     if (!fp){
-        perror_("ERROR: File could not be opened for reading.");
+        *err = "File could not be opened for reading.";
+        return -1;
     }
 
     // Check for valid PNG file
-    fread(header,1,8,fp);
-    if (png_sig_cmp(header,0,8)){
-        perror_("ERROR: File is not recognized as a PNG file.");
+    if (fread(header,1,8,fp) != 8 || png_sig_cmp(header,0,8)){
+        fclose(fp);
+        *err = "File is not recognized as a PNG file.";
+        return -1;
     }
 
     // Initialize structure
@@ -78,18 +97,26 @@ image_f read_png(char *filename){
 
     // Check for valid structure
     if (!pngP){
-        perror_("ERROR: PNG structure allocation failed.");
+        fclose(fp);
+        *err = "PNG structure allocation failed.";
+        return -1;
     }
 
     // Get info struct and check if it is valid
     info_ptr = png_create_info_struct(pngP);
     if (!info_ptr){
-        perror_("ERROR: PNG info structure allocation failed.");
+        png_destroy_read_struct(&pngP,(png_infopp)NULL,(png_infopp)NULL);
+        fclose(fp);
+        *err = "PNG info structure allocation failed.";
+        return -1;
     }
 
     // Generic I/O error checking
     if (setjmp(png_jmpbuf(pngP))){
-        perror_("ERROR: PNG I/O error.");
+        png_destroy_read_struct(&pngP,&info_ptr,(png_infopp)NULL);
+        fclose(fp);
+        *err = "PNG I/O error.";
+        return -1;
     }
 
     // Initialize I/O and read the PNG data
@@ -101,19 +128,44 @@ image_f read_png(char *filename){
     w = png_get_image_width(pngP,info_ptr);
     h = png_get_image_height(pngP,info_ptr);
     color_type = png_get_color_type(pngP,info_ptr);
-    //bit_depth = png_get_bit_depth(pngP,info_ptr);
-    d = color_type == PNG_COLOR_TYPE_RGB_ALPHA ? 4 : 3; // Set depth
+    bit_depth = png_get_bit_depth(pngP,info_ptr);
 
-    // Set jump point for error catching
-    if (setjmp(png_jmpbuf(pngP))){
-        perror_("ERROR: PNG read failure.");
+    // Expand every format to 8 bit grey, RGB or RGBA (grey with
+    // alpha becomes RGBA since there are no two channel images)
+    if (color_type == PNG_COLOR_TYPE_PALETTE){
+        png_set_palette_to_rgb(pngP);
     }
+    if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8){
+        png_set_expand_gray_1_2_4_to_8(pngP);
+    }
+    if (bit_depth == 16){
+        png_set_strip_16(pngP);
+    }
+    if (png_get_valid(pngP,info_ptr,PNG_INFO_tRNS)){
+        png_set_tRNS_to_alpha(pngP);
+        if (color_type == PNG_COLOR_TYPE_GRAY){
+            png_set_gray_to_rgb(pngP);
+        }
+    }
+    if (color_type == PNG_COLOR_TYPE_GRAY_ALPHA){
+        png_set_gray_to_rgb(pngP);
+    }
+    png_read_update_info(pngP,info_ptr);
+    d = png_get_channels(pngP,info_ptr); // Set depth
 
-    // Allocate space to read a single row
+    // Allocate space to read a single row and the image
     rowBytes = (png_byte*)malloc(png_get_rowbytes(pngP,info_ptr));
+    alloc_image(out,h,w,d);
 
-    // Allocate image
-    alloc_image(&out,h,w,d);
+    // Set jump point for error catching
+    if (setjmp(png_jmpbuf(pngP))){
+        free(rowBytes);
+        dealloc_image(out);
+        png_destroy_read_struct(&pngP,&info_ptr,(png_infopp)NULL);
+        fclose(fp);
+        *err = "PNG read failure.";
+        return -1;
+    }
 
     // Read file
     for (row=0; row<h; row++){
@@ -121,7 +173,7 @@ image_f read_png(char *filename){
         png_read_row(pngP,(png_bytep)rowBytes,NULL);
         for (col=0; col<w; col++){
             for (dep=0; dep<d; dep++){
-                out.data[dep*w*h+row*w+col] = (float)((unsigned int)rowBytes[dep+col*d])/255.0;
+                (*out).data[dep*w*h+row*w+col] = (float)((unsigned int)rowBytes[dep+col*d])/255.0;
             }
         }
     }
@@ -136,18 +188,39 @@ image_f read_png(char *filename){
     pngP = NULL;
     info_ptr = NULL;
 
+    return 0;
+}
+
+/*
+ * Reads a PNG file into a struct, aborting on failure.
+ *
+ * Inputs:
+ *     filename - The name of the PNG file
+ * Outputs:
+ *     out - The image read from the file
+ */
+image_f read_png(char *filename){
+    image_f out;     // Output image
+    const char *err; // Reason for failure
+
+    if (load_png(&out,filename,&err) != 0){
+        png_abort(err);
+    }
     return out;
 }
 
 /*
- * Writes a PNG struct to a file.
+ * Writes a PNG struct to a file without aborting on failure.
  *
  * Inputs:
  *     img - The image pointer
  *     filename - The name of the output PNG file
  *     bitDepth - The number of bits to represent the output (8,16, or 32)
+ *     err - The reason for any failure (modified)
+ * Outputs:
+ *     ret - 0 on success, -1 on failure
  */
-void write_png(image_f *img, char *filename, unsigned char bitDepth){
+int save_png(image_f *img, char *filename, unsigned char bitDepth, const char **err){
     png_structp out_ptr;
     png_infop info_ptr;
     png_byte *rowBytes;
@@ -156,54 +229,64 @@ void write_png(image_f *img, char *filename, unsigned char bitDepth){
     int dep;
     int h = (*img).height;
     int w = (*img).width;
-    int d = (*img).depth>3 ? 4 : 3; // Only allow RGB or RGBA
+    int d = (*img).depth==1 ? 1 : ((*img).depth>3 ? 4 : 3); // Only allow grey, RGB or RGBA
 
     // Open file for writing
     FILE *fp = fopen(filename,"wb");
 
     // Check for NULL file pointer
     if (!fp){
-        perror_("ERROR: File could not be opened for writing.");
+        *err = "File could not be opened for writing.";
+        return -1;
     }
 
     // Initialize structure for writing PNG and check if it was created properly
     out_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,NULL,NULL,NULL);
     if (!out_ptr){
-        perror_("ERROR: Could not create PNG structure.");
+        fclose(fp);
+        *err = "Could not create PNG structure.";
+        return -1;
     }
 
     // Set up info pointer and check if it was created properly
     info_ptr = png_create_info_struct(out_ptr);
     if (!info_ptr){
-        perror_("ERROR: Could not create info structure.");
+        png_destroy_write_struct(&out_ptr,(png_infopp)NULL);
+        fclose(fp);
+        *err = "Could not create info structure.";
+        return -1;
     }
 
-    // Set up jump point for I/O error catching
+    // Set up jump point for I/O and header error catching
     if (setjmp(png_jmpbuf(out_ptr))){
-        perror_("ERROR: I/O failure.");
+        png_destroy_write_struct(&out_ptr,&info_ptr);
+        fclose(fp);
+        *err = "Header write failure.";
+        return -1;
     }
 
     // Initialize I/O
     png_init_io(out_ptr,fp);
 
-    // Set up jump point for header error catching
-    if (setjmp(png_jmpbuf(out_ptr))){
-        perror_("ERROR: Header write failure.");
-    }
-
     // Write header information
     png_set_IHDR(out_ptr,info_ptr,w,h,
-                 (png_byte)bitDepth, d==3 ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_RGB_ALPHA,
+                 (png_byte)bitDepth, d==1 ? PNG_COLOR_TYPE_GRAY : (d==3 ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_RGB_ALPHA),
                  PNG_INTERLACE_NONE,PNG_COMPRESSION_TYPE_BASE,PNG_FILTER_TYPE_BASE);
     png_write_info(out_ptr,info_ptr);
 
+    // Allocate space to write a single row
+    rowBytes = (png_byte*)malloc(png_get_rowbytes(out_ptr,info_ptr));
+
     // Set up jump point for writing error catching
     if (setjmp(png_jmpbuf(out_ptr))){
-        perror_("ERROR: Error during PNG write.");
+        free(rowBytes);
+        png_destroy_write_struct(&out_ptr,&info_ptr);
+        fclose(fp);
+        *err = "Error during PNG write.";
+        return -1;
     }
 
     // Convert float image to byte image and write it to the file
-    rowBytes = (png_byte*)malloc(png_get_rowbytes(out_ptr,info_ptr));
     for (row=0; row<h; row++){
         for (col=0; col<w; col++){
             for (dep=0; dep<d; dep++){
@@ -214,11 +297,6 @@ void write_png(image_f *img, char *filename, unsigned char bitDepth){
         png_write_row(out_ptr,(png_bytep)rowBytes);
     }
 
-    // Set up jump point for file end error catching
-    if (setjmp(png_jmpbuf(out_ptr))){
-        perror_("ERROR: End of file write failure.");
-    }
-
     // Write end of file information
     png_write_end(out_ptr,NULL);
 
@@ -229,8 +307,29 @@ void write_png(image_f *img, char *filename, unsigned char bitDepth){
     out_ptr = NULL;
     info_ptr = NULL;
 
-    // Close file
-    fclose(fp);
+    // Close file (buffered data may still fail to be written)
+    if (fclose(fp) != 0){
+        *err = "File could not be written.";
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Writes a PNG struct to a file, aborting on failure.
+ *
+ * Inputs:
+ *     img - The image pointer
+ *     filename - The name of the output PNG file
+ *     bitDepth - The number of bits to represent the output (8,16, or 32)
+ */
+void write_png(image_f *img, char *filename, unsigned char bitDepth){
+    const char *err; // Reason for failure
+
+    if (save_png(img,filename,bitDepth,&err) != 0){
+        png_abort(err);
+    }
 }
 
 /*
@@ -246,8 +345,11 @@ void write_png(image_f *img, char *filename, unsigned char bitDepth){
  *     method - The method of interpolation
  */
 void image_scale(image_f *dst, image_f *src, int dstHeight, int dstWidth, interp_m method){
-    int x,y,z; // Iterators
-    int h,w,d; // Boundaries
+    int x,y,z;  // Iterators
+    int h,w,d;  // Boundaries
+    int *cols;  // Source column per destination column
+    float *in;  // Source row
+    float *out; // Destination row
 
     // Save boundaries
     h = (*src).height; w = (*src).width; d = (*src).depth;
@@ -257,21 +359,74 @@ void image_scale(image_f *dst, image_f *src, int dstHeight, int dstWidth, interp
 
     // Check for interpolation method
     if (method == SIMPLE){
-        for (y=0; y<dstHeight; y++){
-            for (x=0; x<dstWidth; x++){
-                for (z=0; z<d; z++){
-                    (*dst).data[z*dstHeight*dstWidth+y*dstWidth+x] =
-                        (*src).data[z*h*w + (int)((float)y*((float)h/(float)dstHeight))*w +
-                                            (int)((float)x*((float)w/(float)dstWidth))];
+        // Precompute source columns (shared by every row and plane)
+        cols = (int*)malloc(sizeof(int)*dstWidth);
+        if (!cols){
+            perror_("ERROR: Column allocation failed.");
+        }
+        for (x=0; x<dstWidth; x++){
+            cols[x] = (int)((float)x*((float)w/(float)dstWidth));
+        }
+
+        for (z=0; z<d; z++){
+            for (y=0; y<dstHeight; y++){
+                in = &(*src).data[z*h*w + (int)((float)y*((float)h/(float)dstHeight))*w];
+                out = &(*dst).data[z*dstHeight*dstWidth+y*dstWidth];
+                for (x=0; x<dstWidth; x++){
+                    out[x] = in[cols[x]];
                 }
             }
         }
+        free(cols);
     }
     else {
         perror_("ERROR: Function unimplemented");
     }
 }
 
+/*
+ * This shrinks a given image by an integer factor by
+ * averaging each factor x factor block of pixels and then
+ * stores that into an unallocated image pointer.
+ *
+ * Inputs:
+ *     dst - The destination image pointer (modified)
+ *     src - The source image pointer
+ *     factor - The shrinking factor
+ */
+void image_shrink(image_f *dst, image_f *src, int factor){
+    int x,y,z,i,j; // Iterators
+    int h,w,d;     // Boundaries
+    int dH,dW;     // Destination boundaries
+    float sum;     // Block sum
+
+    // Save boundaries
+    h = (*src).height; w = (*src).width; d = (*src).depth;
+    factor = factor > 1 ? factor : 1;
+    if (factor > h || factor > w){
+        perror_("ERROR: Shrinking factor exceeds image size.");
+    }
+    dH = h/factor; dW = w/factor;
+
+    // Allocate destination image
+    alloc_image(dst,dH,dW,d);
+
+    // Average every block
+    for (z=0; z<d; z++){
+        for (y=0; y<dH; y++){
+            for (x=0; x<dW; x++){
+                sum = 0;
+                for (j=0; j<factor; j++){
+                    for (i=0; i<factor; i++){
+                        sum += (*src).data[z*h*w+(y*factor+j)*w+x*factor+i];
+                    }
+                }
+                (*dst).data[z*dH*dW+y*dW+x] = sum/(float)(factor*factor);
+            }
+        }
+    }
+}
+
 /*
  * This performs a point-wise addition between
  * two images and stores the result in the first image.
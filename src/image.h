@@ -31,15 +31,21 @@ typedef enum{
 } interp_m;
 
 
+/**** Error handling ****/
+void perror_(const char* s);
+
 /**** Basic struct operations ****/
 void alloc_image(image_f *img, int height, int width, int depth);
 void dealloc_image(image_f *img);
 
 /**** Image operations ****/
+int load_png(image_f *out, char *filename, const char **err);
 image_f read_png(char *filename);
+int save_png(image_f *img, char *filename, unsigned char bitDepth, const char **err);
 void write_png(image_f *img, char *filename, unsigned char bit_depth);
 void image_rotate(image_f *img, float angle);
 void image_scale(image_f *dst, image_f *src, int dstHeight, int dstWidth, interp_m method);
+void image_shrink(image_f *dst, image_f *src, int factor);
 void image_add(image_f *img1, image_f *img2);
 void image_mul(image_f *img1, image_f *img2);
 void image_div(image_f *img1, image_f *img2);
@@ -0,0 +1,339 @@
+/*
+ * This parses tiling jobs given as command-line
+ * style argument lists.
+ *
+ * Author: Michael Dushkoff (mad1841@rit.edu)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "job.h"
+
+// Definitions
+#define NUM_FLAGS (17)
+
+// Basic enumeration of flags
+typedef enum{
+    NONE,
+    COLOR,
+    OCTAVE,
+    HEIGHT,
+    WIDTH,
+    BLUR,
+    ROTATION,
+    ROTVAR,
+    SCALE,
+    SCALEVAR,
+    SEED,
+    AUTO,
+    MAP,
+    NORMAL,
+    BLEND,
+    LEVELS,
+    HELP
+} FlagType;
+
+// Corresponding flag definitions
+const char *flagDefs[] = {"","-c","-o","-h","-w","-m","-R","-r","-S","-s","-x","--auto","-M","-N","-b","-l","--help"};
+
+/*
+ * Print the program usage to the user.
+ */
+void usage(){
+    printf("Usage:\n");
+    printf("    tilemaker input.png output.png [options]\n");
+    printf("    tilemaker --serve [-k cacheMB] [-u socket]\n");
+    printf("    tilemaker --batch [jobs.txt] [-d num] [-t num] [-e num] [-q num]\n");
+    printf("Options:\n");
+    printf("  -c [R,G,B]   Background color\n");
+    printf("  -o           Octave\n");
+    printf("  -h           Patch Height\n");
+    printf("  -w           Patch Width\n");
+    printf("  -m           Mask Blur\n");
+    printf("  -R           Base Rotation (radians)\n");
+    printf("  -r           Rotation Variance\n");
+    printf("  -S           Base Scale Multiplier\n");
+    printf("  -s           Scale Variance\n");
+    printf("  -x           Seed\n");
+    printf("  --auto       Search for octave, patch size and mask blur (unless given)\n");
+    printf("  -M [in,out]  Additional aligned map (same placements)\n");
+    printf("  -N [in,out]  Additional aligned normal map\n");
+    printf("  -b           Blending method (average, pyramid or poisson)\n");
+    printf("  -l           Pyramid levels (Default=0 implies automatic)\n");
+    printf("  --help       Show usage information\n");
+    printf("Server options:\n");
+    printf("  -k           Cache size in megabytes (Default=512)\n");
+    printf("  -u           Unix domain socket path (Default=stdin)\n");
+    printf("Batch options:\n");
+    printf("  -d           Decode threads (Default=1)\n");
+    printf("  -t           Tiling threads (Default=number of cores)\n");
+    printf("  -e           Encode threads (Default=1)\n");
+    printf("  -q           Jobs queued between stages (Default=2)\n");
+}
+
+/*
+ * Check a given string to determine if it is a flag.
+ *
+ * Inputs:
+ *     str - The string to check
+ * Outputs:
+ *     flag - An enumeration of the flag type
+ */
+FlagType check_flag(char *str){
+    int i;
+
+    // Loop through all flag types
+    for (i=1; i<NUM_FLAGS; i++){
+        if (strcmp(str,flagDefs[i]) == 0){
+            return i;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Parse given arguments and corresponding flag.
+ *
+ * Inputs:
+ *     args - The argument pointer (modified)
+ *     str - The string value to parse
+ *     flag - The given FlagType to apply
+ * Outputs:
+ *     ret - 0 on success, -1 if the value is invalid
+ */
+int parseArgs(tile_args *args, char *str, FlagType flag){
+    switch(flag){
+        case COLOR:
+            // TODO: Parse color information
+            //(*args).bgColor.r =
+            //(*args).bgColor.g =
+            //(*args).bgColor.b =
+            break;
+        case OCTAVE:
+            (*args).octave = atoi(str);
+            //printf("Octave: %d\n",(*args).octave);
+            break;
+        case HEIGHT:
+            (*args).pHeight = atoi(str);
+            //printf("Height: %d\n",(*args).pHeight);
+            break;
+        case WIDTH:
+            (*args).pWidth = atoi(str);
+            //printf("Width: %d\n",(*args).pWidth);
+            break;
+        case BLUR:
+            (*args).blur = atof(str);
+            //printf("Blur: %f\n",(*args).blur);
+            break;
+        case ROTATION:
+            (*args).rotBase = atof(str);
+            //printf("Rotation: %f\n",(*args).rotBase);
+            break;
+        case ROTVAR:
+            (*args).rotVar = atof(str);
+            //printf("Rotation Variance: %f\n",(*args).rotVar);
+            break;
+        case SCALE:
+            (*args).scaleBase = atof(str);
+            //printf("Scale: %f\n",(*args).scaleBase);
+            break;
+        case SCALEVAR:
+            (*args).scaleVar = atof(str);
+            //printf("Scale Variance: %f\n",(*args).scaleVar);
+            break;
+        case SEED:
+            (*args).seed = atoi(str);
+            //printf("SEED: %d\n",(*args).seed);
+            break;
+        case BLEND:
+            if (strcmp(str,"average") == 0){
+                (*args).blend = BLEND_AVERAGE;
+            }
+            else if (strcmp(str,"pyramid") == 0){
+                (*args).blend = BLEND_PYRAMID;
+            }
+            else if (strcmp(str,"poisson") == 0){
+                (*args).blend = BLEND_POISSON;
+            }
+            else{
+                return -1;
+            }
+            break;
+        case LEVELS:
+            (*args).levels = atoi(str);
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+/*
+ * Parse an additional aligned map given as "in.png,out.png".
+ *
+ * Inputs:
+ *     job - The job to add the map to (modified)
+ *     str - The string value to parse (modified)
+ *     normal - Whether the map is a normal map
+ * Outputs:
+ *     ret - 0 on success, -1 if the map is invalid
+ */
+int parseMap(tile_job *job, char *str, int normal){
+    char *sep = strchr(str,',');
+
+    if (!sep || sep == str || !sep[1] || (*job).numMaps >= MAX_MAPS){
+        return -1;
+    }
+    *sep = '\0';
+    (*job).mapIn[(*job).numMaps] = str;
+    (*job).mapOut[(*job).numMaps] = sep+1;
+    (*job).mapNormal[(*job).numMaps] = normal;
+    (*job).numMaps++;
+
+    return 0;
+}
+
+/*
+ * This parses a single job from an argument list of the
+ * form "input.png output.png [options]".
+ *
+ * Inputs:
+ *     job - The job to populate (modified)
+ *     argc - The number of arguments
+ *     argv - The argument list (starting at the input file)
+ * Outputs:
+ *     ret - 0 on success, -1 if the arguments are invalid
+ */
+int parse_job(tile_job *job, int argc, char *argv[]){
+    int i;                    // Iterator
+    FlagType flag = NONE;     // Flag type mapped in order
+    FlagType prevFlag = NONE; // Previously encountered flag
+    int fixed = 0;            // Parameters given explicitly
+
+    // Initial argument number check
+    if (argc < 2){
+        return -1;
+    }
+
+    // Set tile input, output files and default arguments
+    setDefaultArgs(&(*job).args);
+    (*job).inFile = argv[0];
+    (*job).outFile = argv[1];
+    (*job).numMaps = 1;
+    (*job).mapIn[0] = argv[0];
+    (*job).mapOut[0] = argv[1];
+    (*job).mapNormal[0] = 0;
+
+    // Parse arguments (skipping files)
+    for (i=2; i<argc; i++){
+        // Get current flag type
+        flag = check_flag(argv[i]);
+
+        // Apply flags without values immediately
+        if (prevFlag == NONE && flag == AUTO){
+            (*job).args.autoTune = SEARCH_ALL;
+            flag = NONE;
+        }
+        // Parse additional maps
+        else if ((prevFlag == MAP || prevFlag == NORMAL) && flag == NONE){
+            if (parseMap(job,argv[i],prevFlag == NORMAL) != 0){
+                return -1;
+            }
+        }
+        // Only parse details if the previous flag is valid
+        else if (prevFlag != NONE && flag == NONE){
+            if (parseArgs(&(*job).args,argv[i],prevFlag) != 0){
+                return -1;
+            }
+            fixed |= prevFlag == OCTAVE ? SEARCH_OCTAVE : 0;
+            fixed |= prevFlag == HEIGHT || prevFlag == WIDTH ? SEARCH_SIZE : 0;
+            fixed |= prevFlag == BLUR ? SEARCH_BLUR : 0;
+        }
+        else if ((prevFlag != NONE && flag != NONE) || flag == HELP){
+            return -1;
+        }
+        prevFlag = flag;
+    }
+
+    // Only search for parameters which were not given
+    (*job).args.autoTune &= ~fixed;
+    if ((*job).args.octave < 0 || (*job).args.octave > MAX_OCTAVE){
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * This checks that every output file of a job can be opened
+ * for writing, without leaving new files behind.
+ *
+ * Inputs:
+ *     job - The job to check
+ * Outputs:
+ *     k - The first unwritable output or -1 if all are writable
+ */
+int check_outputs(tile_job *job){
+    int k;       // Iterator
+    int existed; // Whether the output already exists
+    FILE *fp;    // Output file
+
+    for (k=0; k<(*job).numMaps; k++){
+        existed = access((*job).mapOut[k],F_OK) == 0;
+        fp = fopen((*job).mapOut[k],"ab");
+        if (!fp){
+            return k;
+        }
+        fclose(fp);
+        if (!existed){
+            remove((*job).mapOut[k]);
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * This checks that the octave of a job leaves every placement
+ * cell of the (decoded) input at least one pixel across.
+ * Searched octaves are checked by the search itself.
+ *
+ * Inputs:
+ *     job - The job to check
+ *     height - The input image height
+ *     width - The input image width
+ * Outputs:
+ *     ret - 0 if the octave fits, -1 otherwise
+ */
+int check_octave(tile_job *job, int height, int width){
+    int m = height < width ? height : width; // Smaller side
+
+    if (!((*job).args.autoTune & SEARCH_OCTAVE) && (m >> (*job).args.octave) < 1){
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * This splits a job line into whitespace separated tokens
+ * in place.
+ *
+ * Inputs:
+ *     line - The line to split (modified)
+ *     tokens - The token list (modified)
+ *     maxTokens - The maximum number of tokens
+ * Outputs:
+ *     n - The number of tokens
+ */
+int tokenize_job(char *line, char *tokens[], int maxTokens){
+    int n = 0;
+
+    tokens[n] = strtok(line," \t\r\n");
+    while (tokens[n] && n < maxTokens-1){
+        tokens[++n] = strtok(NULL," \t\r\n");
+    }
+    return n;
+}
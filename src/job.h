@@ -0,0 +1,38 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * *
+ * Predefinitions for parsing a single tiling job
+ * from a command-line style argument list.
+ *
+ * Author: Michael Dushkoff (mad1841@rit.edu)
+ * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "tile.h"
+
+// JOB_H_
+#ifndef JOB_H_
+#define JOB_H_
+
+// Definitions
+#define MAX_LINE (4096)
+#define MAX_TOKENS (64)
+#define MAX_MAPS (8)
+#define MAX_OCTAVE (15) // Largest octave (4^octave placements must fit an int)
+
+/**** Structure declarations ****/
+typedef struct{
+    char *inFile;
+    char *outFile;
+    int numMaps;             // Number of aligned maps (including the first)
+    char *mapIn[MAX_MAPS];   // Input files (mapIn[0] is inFile)
+    char *mapOut[MAX_MAPS];  // Output files (mapOut[0] is outFile)
+    int mapNormal[MAX_MAPS]; // Flags marking normal maps
+    tile_args args;
+} tile_job;
+
+/**** Job operations ****/
+void usage();
+int parse_job(tile_job *job, int argc, char *argv[]);
+int check_outputs(tile_job *job);
+int check_octave(tile_job *job, int height, int width);
+int tokenize_job(char *line, char *tokens[], int maxTokens);
+
+#endif // END JOB_H_
@@ -0,0 +1,479 @@
+/*
+ * This runs batches of jobs through an overlapped pipeline
+ * so that decoding, tiling and encoding of consecutive jobs
+ * happen at the same time.  Each stage has its own pool of
+ * threads and stages are connected by bounded queues, so
+ * throughput approaches that of the slowest stage.
+ *
+ * Author: Michael Dushkoff (mad1841@rit.edu)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "pipeline.h"
+#include "job.h"
+#include "tile.h"
+#include "image.h"
+#include "thread.h"
+#include "search.h"
+
+/**** Structure declarations ****/
+typedef struct pipe_item{
+    char line[MAX_LINE];       // Job line (owns the job strings)
+    char *tokens[MAX_TOKENS];  // Tokenized job line
+    tile_job job;
+    image_f src[MAX_MAPS];
+    image_f dst[MAX_MAPS];
+    const char *error;         // Reason the job failed (NULL if none)
+    char *errorFile;           // File the job failed on (NULL for invalid jobs)
+    int seq;                   // Position of the job in the input
+    struct pipe_item *next;    // Next reply waiting to be reported
+} pipe_item;
+
+typedef struct{
+    pipe_item **items;         // Ring buffer of waiting jobs
+    int size;
+    int head;
+    int count;
+    int producers;             // Threads still pushing jobs
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+} pipe_queue;
+
+typedef struct{
+    FILE *out;                 // Stream replies are written to
+    int next;                  // Sequence number of the next reply
+    pipe_item *pending;        // Finished jobs waiting for earlier ones (by sequence)
+    pthread_mutex_t lock;
+} pipe_report;
+
+typedef struct{
+    pipe_queue *in;
+    pipe_queue *out;           // NULL for the last stage
+    int (*work)(pipe_item *item, pipe_report *report);
+    pipe_report *report;
+    int threads;               // Number of stage threads
+    double busy;               // Thread-seconds spent working
+    int failed;                // Jobs which failed
+    pthread_mutex_t lock;
+} pipe_stage;
+
+/*
+ * This gets the current monotonic time.
+ *
+ * Outputs:
+ *     t - The time in seconds
+ */
+static double now(){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (double)ts.tv_sec+(double)ts.tv_nsec*1e-9;
+}
+
+/*
+ * This initializes an empty bounded queue.
+ *
+ * Inputs:
+ *     q - The queue (modified)
+ *     size - The maximum number of waiting jobs
+ *     producers - The number of threads pushing jobs
+ */
+static void queue_init(pipe_queue *q, int size, int producers){
+    (*q).items = (pipe_item**)malloc(sizeof(pipe_item*)*size);
+    if (!(*q).items){
+        perror_("ERROR: Queue allocation failed.");
+    }
+    (*q).size = size;
+    (*q).head = 0;
+    (*q).count = 0;
+    (*q).producers = producers;
+    pthread_mutex_init(&(*q).lock,NULL);
+    pthread_cond_init(&(*q).notEmpty,NULL);
+    pthread_cond_init(&(*q).notFull,NULL);
+}
+
+/*
+ * This deallocates a queue.
+ *
+ * Inputs:
+ *     q - The queue (modified)
+ */
+static void queue_destroy(pipe_queue *q){
+    free((*q).items);
+    pthread_mutex_destroy(&(*q).lock);
+    pthread_cond_destroy(&(*q).notEmpty);
+    pthread_cond_destroy(&(*q).notFull);
+}
+
+/*
+ * This pushes a job, waiting while the queue is full.
+ *
+ * Inputs:
+ *     q - The queue (modified)
+ *     item - The job to push
+ */
+static void queue_push(pipe_queue *q, pipe_item *item){
+    pthread_mutex_lock(&(*q).lock);
+    while ((*q).count == (*q).size){
+        pthread_cond_wait(&(*q).notFull,&(*q).lock);
+    }
+    (*q).items[((*q).head+(*q).count)%(*q).size] = item;
+    (*q).count++;
+    pthread_cond_signal(&(*q).notEmpty);
+    pthread_mutex_unlock(&(*q).lock);
+}
+
+/*
+ * This pops a job, waiting while the queue is empty.
+ *
+ * Inputs:
+ *     q - The queue (modified)
+ * Outputs:
+ *     item - The job or NULL once all producers are done
+ */
+static pipe_item *queue_pop(pipe_queue *q){
+    pipe_item *item = NULL;
+
+    pthread_mutex_lock(&(*q).lock);
+    while ((*q).count == 0 && (*q).producers > 0){
+        pthread_cond_wait(&(*q).notEmpty,&(*q).lock);
+    }
+    if ((*q).count > 0){
+        item = (*q).items[(*q).head];
+        (*q).head = ((*q).head+1)%(*q).size;
+        (*q).count--;
+        pthread_cond_signal(&(*q).notFull);
+    }
+    pthread_mutex_unlock(&(*q).lock);
+
+    return item;
+}
+
+/*
+ * This marks one producer of a queue as done.
+ *
+ * Inputs:
+ *     q - The queue (modified)
+ */
+static void queue_done(pipe_queue *q){
+    pthread_mutex_lock(&(*q).lock);
+    (*q).producers--;
+    pthread_cond_broadcast(&(*q).notEmpty);
+    pthread_mutex_unlock(&(*q).lock);
+}
+
+/*
+ * This retires a finished job.  Jobs finish out of order when
+ * stages have several threads, so replies are held back until
+ * every earlier job has been reported and are then written in
+ * the order the jobs were read.
+ *
+ * Inputs:
+ *     report - The reply stream and held back replies (modified)
+ *     item - The finished job (freed)
+ */
+static void report_item(pipe_report *report, pipe_item *item){
+    pipe_item **p;  // Insertion point
+
+    pthread_mutex_lock(&(*report).lock);
+    p = &(*report).pending;
+    while (*p && (**p).seq < (*item).seq){
+        p = &(**p).next;
+    }
+    (*item).next = *p;
+    *p = item;
+
+    // Write every reply which is no longer waiting for an earlier one
+    while ((*report).pending && (*(*report).pending).seq == (*report).next){
+        item = (*report).pending;
+        (*report).pending = (*item).next;
+        if ((*item).error && (*item).errorFile){
+            fprintf((*report).out,"error %s: %s\n",(*item).errorFile,(*item).error);
+        }
+        else if ((*item).error){
+            fprintf((*report).out,"error %s\n",(*item).error);
+        }
+        else{
+            fprintf((*report).out,"ok %s\n",(*item).job.outFile);
+        }
+        (*report).next++;
+        free(item);
+    }
+    fflush((*report).out);
+    pthread_mutex_unlock(&(*report).lock);
+}
+
+/*
+ * Decode stage: checks the outputs, reads the input images and
+ * checks that they are aligned and fit the octave.  Failed
+ * (and invalid) jobs are passed on untouched so that they are
+ * reported in order.
+ */
+static int decode_work(pipe_item *item, pipe_report *report){
+    int k,j;
+
+    if ((*item).error){
+        return 1;
+    }
+    k = check_outputs(&(*item).job);
+    if (k >= 0){
+        (*item).error = "could not open for writing";
+        (*item).errorFile = (*item).job.mapOut[k];
+        return 1;
+    }
+    for (k=0; k<(*item).job.numMaps; k++){
+        if (load_png(&(*item).src[k],(*item).job.mapIn[k],&(*item).error) != 0){
+            (*item).errorFile = (*item).job.mapIn[k];
+            for (j=0; j<k; j++){
+                dealloc_image(&(*item).src[j]);
+            }
+            return 1;
+        }
+    }
+
+    // Check that all maps are aligned
+    for (k=1; k<(*item).job.numMaps; k++){
+        if ((*item).src[k].height != (*item).src[0].height || (*item).src[k].width != (*item).src[0].width){
+            (*item).error = "size does not match the first input";
+            (*item).errorFile = (*item).job.mapIn[k];
+            for (j=0; j<(*item).job.numMaps; j++){
+                dealloc_image(&(*item).src[j]);
+            }
+            return 1;
+        }
+    }
+
+    // Check that every placement cell is at least one pixel
+    if (check_octave(&(*item).job,(*item).src[0].height,(*item).src[0].width) != 0){
+        (*item).error = "octave too large for the image size";
+        (*item).errorFile = (*item).job.mapIn[0];
+        for (j=0; j<(*item).job.numMaps; j++){
+            dealloc_image(&(*item).src[j]);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Tile stage: performs the tiling operation.
+ */
+static int tile_work(pipe_item *item, pipe_report *report){
+    int k;
+
+    if ((*item).error){
+        return 1;
+    }
+
+    // Search on this stage's thread so that failures are reported
+    if ((*item).job.args.autoTune){
+        if (searchArgs(&(*item).job.args,&(*item).src[0],&(*item).error) != 0){
+            (*item).errorFile = (*item).job.mapIn[0];
+            for (k=0; k<(*item).job.numMaps; k++){
+                dealloc_image(&(*item).src[k]);
+            }
+            return 1;
+        }
+        (*item).job.args.autoTune = 0;
+    }
+    tileImages((*item).dst,(*item).src,(*item).job.numMaps,(*item).job.mapNormal,(*item).job.args);
+    for (k=0; k<(*item).job.numMaps; k++){
+        dealloc_image(&(*item).src[k]);
+    }
+    return 0;
+}
+
+/*
+ * Encode stage: writes the output images and retires the job.
+ */
+static int encode_work(pipe_item *item, pipe_report *report){
+    int k;
+    int failed;
+
+    // Write the outputs of tiled jobs (stopping at the first failure)
+    if (!(*item).error){
+        for (k=0; k<(*item).job.numMaps; k++){
+            if (!(*item).error && save_png(&(*item).dst[k],(*item).job.mapOut[k],8,&(*item).error) != 0){
+                (*item).errorFile = (*item).job.mapOut[k];
+            }
+            dealloc_image(&(*item).dst[k]);
+        }
+    }
+    failed = (*item).error != NULL;
+    report_item(report,item);
+
+    return failed;
+}
+
+/*
+ * This is the body of every stage thread, which moves jobs
+ * from the stage's input queue to its output queue.
+ *
+ * Inputs:
+ *     arg - The stage
+ */
+static void *stage_worker(void *arg){
+    pipe_stage *stage = (pipe_stage*)arg;
+    pipe_item *item;  // Current job
+    double t;         // Start time
+    double busy = 0;  // Time spent working
+    int failed = 0;   // Jobs which failed
+
+    // Jobs of a stage with several threads already share the cores
+    serial_loops((*stage).threads > 1);
+
+    while ((item = queue_pop((*stage).in))){
+        t = now();
+        failed += (*stage).work(item,(*stage).report);
+        busy += now()-t;
+        if ((*stage).out){
+            queue_push((*stage).out,item);
+        }
+    }
+    if ((*stage).out){
+        queue_done((*stage).out);
+    }
+
+    // Record time spent
+    pthread_mutex_lock(&(*stage).lock);
+    (*stage).busy += busy;
+    (*stage).failed += failed;
+    pthread_mutex_unlock(&(*stage).lock);
+
+    return NULL;
+}
+
+/*
+ * This sets the arguments of a given pipeline argument
+ * structure to their defaults.
+ *
+ * Inputs:
+ *     args - The given argument structure (modified)
+ */
+void setDefaultPipeArgs(pipe_args *args){
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    (*args).decoders = 1;
+    (*args).tilers = cores > 0 ? (int)cores : 1;
+    (*args).encoders = 1;
+    (*args).depth = 2;
+}
+
+/*
+ * This runs every job read from a line based stream through
+ * the pipeline and reports on completion.
+ *
+ * Inputs:
+ *     in - The stream of job lines ("input.png output.png [options]")
+ *     out - The stream to report completed jobs to
+ *     args - Pipeline arguments
+ * Outputs:
+ *     failed - The number of invalid or failed jobs
+ */
+int run_pipeline(FILE *in, FILE *out, pipe_args args){
+    pipe_queue queues[3];    // Decode, tile and encode queues
+    pipe_stage stages[3];    // Decode, tile and encode stages
+    int threads[3];          // Threads per stage
+    pthread_t *workers;      // All stage threads
+    pipe_report report;      // Reply stream
+    pipe_item *item;         // Current job
+    int i,j,k;               // Iterators
+    int n;                   // Number of tokens
+    int seq = 0;             // Number of jobs read
+    int jobs = 0;            // Number of jobs run
+    int failed = 0;          // Number of invalid or failed jobs
+    double t;                // Start time
+    int (*work[3])(pipe_item*,pipe_report*) = {decode_work,tile_work,encode_work};
+
+    // Replies are written in job order
+    report.out = out;
+    report.next = 0;
+    report.pending = NULL;
+    pthread_mutex_init(&report.lock,NULL);
+
+    // Create queues and stages (each queue is fed by the previous stage)
+    threads[0] = args.decoders > 0 ? args.decoders : 1;
+    threads[1] = args.tilers > 0 ? args.tilers : 1;
+    threads[2] = args.encoders > 0 ? args.encoders : 1;
+    for (i=0; i<3; i++){
+        queue_init(&queues[i],args.depth > 0 ? args.depth : 1,i == 0 ? 1 : threads[i-1]);
+        stages[i].in = &queues[i];
+        stages[i].out = i < 2 ? &queues[i+1] : NULL;
+        stages[i].work = work[i];
+        stages[i].report = &report;
+        stages[i].threads = threads[i];
+        stages[i].busy = 0;
+        stages[i].failed = 0;
+        pthread_mutex_init(&stages[i].lock,NULL);
+    }
+
+    // Start stage threads
+    t = now();
+    workers = (pthread_t*)malloc(sizeof(pthread_t)*(threads[0]+threads[1]+threads[2]));
+    if (!workers){
+        perror_("ERROR: Thread allocation failed.");
+    }
+    for (i=0,k=0; i<3; i++){
+        for (j=0; j<threads[i]; j++,k++){
+            if (pthread_create(&workers[k],NULL,stage_worker,&stages[i]) != 0){
+                perror_("ERROR: Thread creation failed.");
+            }
+        }
+    }
+
+    // Feed jobs into the decode stage
+    while (1){
+        item = (pipe_item*)malloc(sizeof(pipe_item));
+        if (!item){
+            perror_("ERROR: Job allocation failed.");
+        }
+        if (!fgets((*item).line,MAX_LINE,in)){
+            free(item);
+            break;
+        }
+        n = tokenize_job((*item).line,(*item).tokens,MAX_TOKENS);
+        if (n == 0){
+            free(item);
+            continue;
+        }
+
+        // Invalid jobs are passed through to be reported in order
+        (*item).error = NULL;
+        (*item).errorFile = NULL;
+        (*item).seq = seq++;
+        if (parse_job(&(*item).job,n,(*item).tokens) != 0){
+            (*item).error = "invalid job";
+        }
+        else{
+            jobs++;
+        }
+        queue_push(&queues[0],item);
+    }
+    queue_done(&queues[0]);
+
+    // Wait for all jobs to drain
+    for (i=0; i<k; i++){
+        pthread_join(workers[i],NULL);
+    }
+    free(workers);
+
+    // Report stage utilization
+    fprintf(stderr,"batch jobs=%d time=%.2fs decode=%.2fs tile=%.2fs encode=%.2fs\n",
+            jobs,now()-t,stages[0].busy,stages[1].busy,stages[2].busy);
+
+    // Deallocate (only the last stage retires failed jobs)
+    failed += stages[2].failed;
+    for (i=0; i<3; i++){
+        queue_destroy(&queues[i]);
+        pthread_mutex_destroy(&stages[i].lock);
+    }
+    pthread_mutex_destroy(&report.lock);
+
+    return failed;
+}
@@ -0,0 +1,26 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * *
+ * Predefinitions for the overlapped decode, tile
+ * and encode pipeline used for batches of jobs.
+ *
+ * Author: Michael Dushkoff (mad1841@rit.edu)
+ * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+
+// PIPELINE_H_
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+/**** Structure declarations ****/
+typedef struct{
+    int decoders; // Decode stage threads
+    int tilers;   // Tile stage threads
+    int encoders; // Encode stage threads
+    int depth;    // Maximum jobs waiting between stages
+} pipe_args;
+
+/**** Pipeline operations ****/
+void setDefaultPipeArgs(pipe_args *args);
+int run_pipeline(FILE *in, FILE *out, pipe_args args);
+
+#endif // END PIPELINE_H_
@@ -0,0 +1,723 @@
+/*
+ * This performs gradient-domain (Poisson) blending of tile
+ * placements.  The tiles' gradients are blended instead of
+ * their values and the output is recovered by solving the
+ * periodic Poisson equation with a multigrid solver, which
+ * removes brightness steps between placements.
+ *
+ * Author: Michael Dushkoff (mad1841@rit.edu)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "poisson.h"
+#include "thread.h"
+
+// Definitions
+#define MAX_GRIDS (32)        // Maximum number of multigrid levels
+#define MIN_GRID (4)          // Smallest coarsened grid dimension
+#define MAX_COARSE (1024)     // Largest grid solved directly
+#define SMOOTH_STEPS (2)      // Smoothing sweeps before and after correction
+#define MAX_CYCLES (12)       // Maximum number of V-cycles
+#define TOLERANCE (1e-4)      // Relative residual to stop at
+#define CG_TOLERANCE (1e-6)   // Relative residual of the coarsest solve
+#define MIN_RESIDUAL (1e-7)   // Residual reached by rounding alone (flat planes)
+#define SERIAL_PIXELS (32768) // Grids smaller than this are not split across threads
+#define EPS_WEIGHT (1e-6)     // Accumulated weight considered uncovered
+
+/**** Structure declarations ****/
+typedef struct{
+    int *index;               // First coarse cell of each fine cell
+    float *weight;            // Weight of that cell (the next one gets the rest)
+    int *first;               // First contribution to each coarse cell (coarse+1 entries)
+    int *cells;               // Fine cell of each contribution
+    float *weights;           // Scaled weight of each contribution
+} mg_transfer;
+
+typedef struct{
+    image_f u;                // Solution (or correction)
+    image_f f;                // Right hand side
+    image_f r;                // Residual
+    image_f t;                // Residual restricted along rows only
+    float sx;                 // Inverse squared grid spacings
+    float sy;
+    mg_transfer tx;           // Transfers to the next coarser level
+    mg_transfer ty;
+} mg_level;
+
+typedef struct{
+    mg_level *lv;             // Current level
+    mg_level *next;           // Next coarser level
+    int color;                // Red-black smoothing color
+    int row0;                 // First row of each plane to process
+    int rows;                 // Number of rows of each plane to process
+} mg_ctx;
+
+typedef struct{
+    image_f *f;               // Divergence plane
+    image_f *g;               // Blended gradients (x plane then y plane)
+    image_f *acc;             // Accumulated gradient weights
+} div_ctx;
+
+/*
+ * This creates the transfer between a periodic grid dimension
+ * and a coarser one covering the same length.  Each fine cell
+ * is linearly interpolated from the two nearest coarse cell
+ * centers, which for exact halving gives the usual 1/4, 3/4
+ * weights, and restriction uses the transposed weights scaled
+ * so that means are kept.  Any coarse size works, so odd sizes
+ * are coarsened as well as even ones.
+ *
+ * Inputs:
+ *     t - The transfer (modified)
+ *     n - The fine size
+ *     nc - The coarse size
+ */
+static void makeTransfer(mg_transfer *t, int n, int nc){
+    int *next;  // Fill position of each coarse cell
+    double p;   // Fine cell center in coarse cell coordinates
+    int i,c,e;  // Iterators
+
+    (*t).index = (int*)malloc(sizeof(int)*n);
+    (*t).weight = (float*)malloc(sizeof(float)*n);
+    (*t).first = (int*)calloc(nc+1,sizeof(int));
+    (*t).cells = (int*)malloc(sizeof(int)*2*n);
+    (*t).weights = (float*)malloc(sizeof(float)*2*n);
+    next = (int*)malloc(sizeof(int)*nc);
+    if (!(*t).index || !(*t).weight || !(*t).first || !(*t).cells || !(*t).weights || !next){
+        perror_("ERROR: Transfer allocation failed.");
+    }
+
+    // Interpolation weights (counting contributions per coarse cell)
+    for (i=0; i<n; i++){
+        p = (i+0.5)*nc/n-0.5;
+        c = (int)floor(p);
+        (*t).weight[i] = 1.0-(p-c);
+        (*t).index[i] = (c+nc)%nc;
+        (*t).first[(*t).index[i]+1]++;
+        (*t).first[((*t).index[i]+1)%nc+1]++;
+    }
+
+    // Transposed weights grouped by coarse cell
+    for (c=0; c<nc; c++){
+        (*t).first[c+1] += (*t).first[c];
+        next[c] = (*t).first[c];
+    }
+    for (i=0; i<n; i++){
+        c = (*t).index[i];
+        e = next[c]++;
+        (*t).cells[e] = i;
+        (*t).weights[e] = (*t).weight[i]*nc/n;
+        c = (c+1)%nc;
+        e = next[c]++;
+        (*t).cells[e] = i;
+        (*t).weights[e] = (1.0-(*t).weight[i])*nc/n;
+    }
+
+    free(next);
+}
+
+/*
+ * This deallocates a transfer.
+ *
+ * Inputs:
+ *     t - The transfer
+ */
+static void freeTransfer(mg_transfer *t){
+    free((*t).index);
+    free((*t).weight);
+    free((*t).first);
+    free((*t).cells);
+    free((*t).weights);
+}
+
+/*
+ * This runs a row kernel over a range of rows of every plane
+ * of an image, split across threads unless the work is small.
+ *
+ * Inputs:
+ *     fn - The row kernel
+ *     ctx - The kernel context (modified)
+ *     img - The image whose rows are iterated
+ *     row0 - The first row of each plane
+ *     rows - The number of rows of each plane
+ */
+static void forRows(range_fn fn, mg_ctx *ctx, image_f *img, int row0, int rows){
+    int n = (*img).depth*rows;
+
+    (*ctx).row0 = row0;
+    (*ctx).rows = rows;
+    if (n*(*img).width < SERIAL_PIXELS){
+        fn(ctx,0,n);
+    }
+    else{
+        parallel_for(n,fn,ctx);
+    }
+}
+
+/*
+ * Red-black Gauss-Seidel row kernel.  Only points of one color
+ * are updated and vertical neighbors always have the other
+ * color, so rows are independent (see smooth).
+ */
+static void smoothRows(void *ctx, int begin, int end){
+    mg_level *lv = (*(mg_ctx*)ctx).lv;
+    int color = (*(mg_ctx*)ctx).color;
+    int row0 = (*(mg_ctx*)ctx).row0;
+    int rows = (*(mg_ctx*)ctx).rows;
+    int h = (*lv).u.height;
+    int w = (*lv).u.width;
+    float sx = (*lv).sx;
+    float sy = (*lv).sy;
+    float c = 1.0/(2.0*(sx+sy));
+    float *row,*up,*dn,*f; // Current rows
+    float l,r;             // Horizontal neighbors
+    int i,x,y,p;           // Iterators and plane offset
+
+    for (i=begin; i<end; i++){
+        y = row0+i%rows;
+        p = (i/rows)*h*w;
+        row = &(*lv).u.data[p+y*w];
+        up = &(*lv).u.data[p+((y+h-1)%h)*w];
+        dn = &(*lv).u.data[p+((y+1)%h)*w];
+        f = &(*lv).f.data[p+y*w];
+        for (x=(y+color)&1; x<w; x+=2){
+            l = x > 0 ? row[x-1] : row[w-1];
+            r = x < w-1 ? row[x+1] : row[0];
+            row[x] = c*(sx*(l+r)+sy*(up[x]+dn[x])-f[x]);
+        }
+    }
+}
+
+/*
+ * This runs one red-black smoothing sweep of a color.  For an
+ * odd height the first and last rows share colors across the
+ * wrap, so the last row is smoothed after all others.  (Along
+ * rows the same happens for odd widths, but each row is
+ * smoothed in order by a single thread.)
+ *
+ * Inputs:
+ *     ctx - The multigrid context (modified)
+ *     color - The color to update
+ */
+static void smooth(mg_ctx *ctx, int color){
+    image_f *u = &(*(*ctx).lv).u;
+    int h = (*u).height;
+
+    (*ctx).color = color;
+    forRows(smoothRows,ctx,u,0,h-(h&1));
+    if (h&1){
+        forRows(smoothRows,ctx,u,h-1,1);
+    }
+}
+
+/*
+ * Residual row kernel (r = f - Laplacian(u)).
+ */
+static void residualRows(void *ctx, int begin, int end){
+    mg_level *lv = (*(mg_ctx*)ctx).lv;
+    int row0 = (*(mg_ctx*)ctx).row0;
+    int rows = (*(mg_ctx*)ctx).rows;
+    int h = (*lv).u.height;
+    int w = (*lv).u.width;
+    float sx = (*lv).sx;
+    float sy = (*lv).sy;
+    float *row,*up,*dn,*f,*r; // Current rows
+    int i,x,y,p;              // Iterators and plane offset
+
+    for (i=begin; i<end; i++){
+        y = row0+i%rows;
+        p = (i/rows)*h*w;
+        row = &(*lv).u.data[p+y*w];
+        up = &(*lv).u.data[p+((y+h-1)%h)*w];
+        dn = &(*lv).u.data[p+((y+1)%h)*w];
+        f = &(*lv).f.data[p+y*w];
+        r = &(*lv).r.data[p+y*w];
+        r[0] = f[0]-sx*(row[w-1]+row[w > 1]-2.0f*row[0])-sy*(up[0]+dn[0]-2.0f*row[0]);
+        for (x=1; x<w-1; x++){
+            r[x] = f[x]-sx*(row[x-1]+row[x+1]-2.0f*row[x])-sy*(up[x]+dn[x]-2.0f*row[x]);
+        }
+        if (w > 1){
+            r[w-1] = f[w-1]-sx*(row[w-2]+row[0]-2.0f*row[w-1])-sy*(up[w-1]+dn[w-1]-2.0f*row[w-1]);
+        }
+    }
+}
+
+/*
+ * Row restriction kernel (restricts each fine residual row
+ * along its length).
+ */
+static void restrictRowsX(void *ctx, int begin, int end){
+    mg_level *lv = (*(mg_ctx*)ctx).lv;
+    mg_transfer *tx = &(*lv).tx;
+    int rows = (*(mg_ctx*)ctx).rows;
+    int w = (*lv).r.width;
+    int wc = (*lv).t.width;
+    float *r,*t;  // Current rows
+    float s;      // Restricted value
+    int i,j,e;    // Iterators
+
+    for (i=begin; i<end; i++){
+        r = &(*lv).r.data[(i/rows)*rows*w+(i%rows)*w];
+        t = &(*lv).t.data[(i/rows)*rows*wc+(i%rows)*wc];
+        for (j=0; j<wc; j++){
+            s = 0;
+            for (e=(*tx).first[j]; e<(*tx).first[j+1]; e++){
+                s += (*tx).weights[e]*r[(*tx).cells[e]];
+            }
+            t[j] = s;
+        }
+    }
+}
+
+/*
+ * Column restriction kernel (combines the row restricted
+ * residual into each coarse right hand side row and clears
+ * the coarse correction).
+ */
+static void restrictRowsY(void *ctx, int begin, int end){
+    mg_level *lv = (*(mg_ctx*)ctx).lv;
+    mg_level *next = (*(mg_ctx*)ctx).next;
+    mg_transfer *ty = &(*lv).ty;
+    int rows = (*(mg_ctx*)ctx).rows;
+    int h = (*lv).t.height;
+    int wc = (*lv).t.width;
+    float *t,*f,*u;  // Current rows
+    float a;         // Contribution weight
+    int i,j,e,I;     // Iterators
+
+    for (i=begin; i<end; i++){
+        I = i%rows;
+        f = &(*next).f.data[(i/rows)*rows*wc+I*wc];
+        u = &(*next).u.data[(i/rows)*rows*wc+I*wc];
+        for (j=0; j<wc; j++){
+            f[j] = 0.0;
+            u[j] = 0.0;
+        }
+        for (e=(*ty).first[I]; e<(*ty).first[I+1]; e++){
+            t = &(*lv).t.data[(i/rows)*h*wc+(*ty).cells[e]*wc];
+            a = (*ty).weights[e];
+            for (j=0; j<wc; j++){
+                f[j] += a*t[j];
+            }
+        }
+    }
+}
+
+/*
+ * Prolongation row kernel (adds the bilinearly interpolated
+ * coarse correction to the fine solution).
+ */
+static void prolongRows(void *ctx, int begin, int end){
+    mg_level *lv = (*(mg_ctx*)ctx).lv;
+    mg_level *next = (*(mg_ctx*)ctx).next;
+    mg_transfer *tx = &(*lv).tx;
+    mg_transfer *ty = &(*lv).ty;
+    int rows = (*(mg_ctx*)ctx).rows;
+    int w = (*lv).u.width;
+    int hc = (*next).u.height;
+    int wc = (*next).u.width;
+    float *c0,*c1,*u; // First and second coarse rows
+    float a,b;        // Weights of the first coarse row and column
+    int i,x,y;        // Iterators
+    int j0,j1;        // First and second coarse columns
+
+    for (i=begin; i<end; i++){
+        y = i%rows;
+        a = (*ty).weight[y];
+        c0 = &(*next).u.data[(i/rows)*hc*wc+(*ty).index[y]*wc];
+        c1 = &(*next).u.data[(i/rows)*hc*wc+(((*ty).index[y]+1)%hc)*wc];
+        u = &(*lv).u.data[(i/rows)*rows*w+y*w];
+        for (x=0; x<w; x++){
+            j0 = (*tx).index[x];
+            j1 = j0+1 < wc ? j0+1 : 0;
+            b = (*tx).weight[x];
+            u[x] += a*(b*c0[j0]+(1.0f-b)*c0[j1])+(1.0f-a)*(b*c1[j0]+(1.0f-b)*c1[j1]);
+        }
+    }
+}
+
+/*
+ * This solves the coarsest level exactly (to a tolerance) by
+ * conjugate gradients on each plane.  The right hand side is
+ * projected to zero mean, which a periodic problem requires.
+ *
+ * Inputs:
+ *     lv - The coarsest level (modified)
+ */
+static void coarseSolve(mg_level *lv){
+    int h = (*lv).u.height;
+    int w = (*lv).u.width;
+    int n = h*w;
+    float sx = (*lv).sx;
+    float sy = (*lv).sy;
+    float *u,*f;            // Current plane
+    float *r,*p,*ap;        // CG vectors
+    double rs,rsNew,pap;    // Dot products
+    double mean,bnorm;      // Right hand side mean and norm
+    float alpha,beta;       // CG step sizes
+    int q,i,it,x,y;         // Iterators
+
+    r = (float*)malloc(sizeof(float)*n);
+    p = (float*)malloc(sizeof(float)*n);
+    ap = (float*)malloc(sizeof(float)*n);
+    if (!r || !p || !ap){
+        perror_("ERROR: Solver allocation failed.");
+    }
+
+    for (q=0; q<(*lv).u.depth; q++){
+        u = &(*lv).u.data[q*n];
+        f = &(*lv).f.data[q*n];
+
+        // Solve -Laplacian(u) = -f (positive semi-definite) for zero mean f
+        mean = 0;
+        for (i=0; i<n; i++){
+            mean += f[i];
+        }
+        mean /= n;
+        bnorm = 0;
+        for (y=0; y<h; y++){
+            for (x=0; x<w; x++){
+                i = y*w+x;
+                r[i] = -(f[i]-mean)-(2.0f*(sx+sy)*u[i]-sx*(u[y*w+(x+w-1)%w]+u[y*w+(x+1)%w])-
+                                     sy*(u[((y+h-1)%h)*w+x]+u[((y+1)%h)*w+x]));
+                bnorm += (f[i]-mean)*(f[i]-mean);
+            }
+        }
+        mean = 0;
+        for (i=0; i<n; i++){
+            mean += r[i];
+        }
+        mean /= n;
+        rs = 0;
+        for (i=0; i<n; i++){
+            r[i] -= mean;
+            p[i] = r[i];
+            rs += r[i]*r[i];
+        }
+
+        for (it=0; it<4*(h+w) && rs > CG_TOLERANCE*CG_TOLERANCE*bnorm && rs > 0; it++){
+            pap = 0;
+            for (y=0; y<h; y++){
+                for (x=0; x<w; x++){
+                    i = y*w+x;
+                    ap[i] = 2.0f*(sx+sy)*p[i]-sx*(p[y*w+(x+w-1)%w]+p[y*w+(x+1)%w])-
+                            sy*(p[((y+h-1)%h)*w+x]+p[((y+1)%h)*w+x]);
+                    pap += p[i]*ap[i];
+                }
+            }
+            if (pap <= 0){
+                break;
+            }
+            alpha = rs/pap;
+            rsNew = 0;
+            for (i=0; i<n; i++){
+                u[i] += alpha*p[i];
+                r[i] -= alpha*ap[i];
+                rsNew += r[i]*r[i];
+            }
+            beta = rsNew/rs;
+            rs = rsNew;
+            for (i=0; i<n; i++){
+                p[i] = r[i]+beta*p[i];
+            }
+        }
+    }
+
+    free(r);
+    free(p);
+    free(ap);
+}
+
+/*
+ * This runs one multigrid V-cycle from the given level.
+ *
+ * Inputs:
+ *     lv - The levels (modified)
+ *     l - The current level
+ *     L - The coarsest level
+ */
+static void vcycle(mg_level *lv, int l, int L){
+    mg_ctx ctx;  // Kernel context
+    int i;       // Iterator
+
+    // Solve the coarsest level directly
+    if (l == L){
+        coarseSolve(&lv[l]);
+        return;
+    }
+    ctx.lv = &lv[l];
+    ctx.next = &lv[l+1];
+
+    // Pre-smooth
+    for (i=0; i<SMOOTH_STEPS; i++){
+        smooth(&ctx,0);
+        smooth(&ctx,1);
+    }
+
+    // Correct from the coarser level
+    forRows(residualRows,&ctx,&lv[l].r,0,lv[l].r.height);
+    forRows(restrictRowsX,&ctx,&lv[l].t,0,lv[l].t.height);
+    forRows(restrictRowsY,&ctx,&lv[l+1].f,0,lv[l+1].f.height);
+    vcycle(lv,l+1,L);
+    forRows(prolongRows,&ctx,&lv[l].u,0,lv[l].u.height);
+
+    // Post-smooth
+    for (i=0; i<SMOOTH_STEPS; i++){
+        smooth(&ctx,1);
+        smooth(&ctx,0);
+    }
+}
+
+/*
+ * This calculates the root mean square of an image.
+ *
+ * Inputs:
+ *     img - The given image
+ * Outputs:
+ *     rms - The root mean square
+ */
+static double rms(image_f *img){
+    int i;
+    int n = (*img).height*(*img).width*(*img).depth;
+    double sum = 0;
+
+    for (i=0; i<n; i++){
+        sum += (double)(*img).data[i]*(*img).data[i];
+    }
+    return sqrt(sum/n);
+}
+
+/*
+ * This solves the periodic Poisson equation Laplacian(u) = f
+ * independently for every plane with multigrid V-cycles
+ * (red-black Gauss-Seidel smoothing with linear interpolation
+ * between levels) down to a coarsest grid of at most
+ * MAX_COARSE cells that is solved by conjugate gradients.
+ * Every dimension of at least twice MIN_GRID is halved
+ * (rounding up) per level, so any size coarsens and the work
+ * stays linear in the number of pixels.  Every kernel is split
+ * across threads by plane and row.  The solution is only
+ * defined up to a constant per plane, which is kept close to
+ * that of the initial guess.
+ *
+ * Inputs:
+ *     u - The initial guess and solution (modified)
+ *     f - The right hand side (same size as u)
+ * Outputs:
+ *     cycles - The number of V-cycles run
+ */
+int poisson_solve(image_f *u, image_f *f){
+    mg_level lv[MAX_GRIDS]; // Multigrid levels
+    mg_ctx ctx;             // Kernel context
+    int h,w,d;              // Boundaries
+    int hc,wc;              // Coarser boundaries
+    int L = 0;              // Coarsest level
+    int l,c;                // Iterators
+    double fnorm;           // Right hand side norm
+
+    // Create levels
+    h = (*u).height; w = (*u).width; d = (*u).depth;
+    lv[0].u = *u;
+    lv[0].f = *f;
+    lv[0].sx = 1.0;
+    lv[0].sy = 1.0;
+    alloc_image(&lv[0].r,h,w,d);
+    while (L+1 < MAX_GRIDS && h*w > MAX_COARSE && (h >= 2*MIN_GRID || w >= 2*MIN_GRID)){
+        hc = h >= 2*MIN_GRID ? (h+1)/2 : h;
+        wc = w >= 2*MIN_GRID ? (w+1)/2 : w;
+        makeTransfer(&lv[L].ty,h,hc);
+        makeTransfer(&lv[L].tx,w,wc);
+        alloc_image(&lv[L].t,h,wc,d);
+        L++;
+        alloc_image(&lv[L].u,hc,wc,d);
+        alloc_image(&lv[L].f,hc,wc,d);
+        alloc_image(&lv[L].r,hc,wc,d);
+        lv[L].sx = ((float)wc/(*u).width)*((float)wc/(*u).width);
+        lv[L].sy = ((float)hc/(*u).height)*((float)hc/(*u).height);
+        h = hc; w = wc;
+    }
+
+    // Run V-cycles until the residual is small
+    fnorm = rms(f);
+    ctx.lv = &lv[0];
+    for (c=0; c<MAX_CYCLES; c++){
+        vcycle(lv,0,L);
+        if (L == 0){
+            c++;
+            break; // Solved directly
+        }
+        forRows(residualRows,&ctx,&lv[0].r,0,lv[0].r.height);
+        if (rms(&lv[0].r) <= fmax(TOLERANCE*fnorm,MIN_RESIDUAL)){
+            c++;
+            break;
+        }
+    }
+
+    // Deallocate
+    dealloc_image(&lv[0].r);
+    for (l=0; l<L; l++){
+        freeTransfer(&lv[l].tx);
+        freeTransfer(&lv[l].ty);
+        dealloc_image(&lv[l].t);
+        dealloc_image(&lv[l+1].u);
+        dealloc_image(&lv[l+1].f);
+        dealloc_image(&lv[l+1].r);
+    }
+
+    return c;
+}
+
+/*
+ * Gradient normalization row kernel (divides the blended
+ * gradients by their accumulated weights; uncovered areas are
+ * flat).
+ */
+static void normalizeRows(void *ctx, int begin, int end){
+    div_ctx *c = (div_ctx*)ctx;
+    int w = (*(*c).f).width;
+    int n = (*(*c).f).height*w;
+    float *gx,*gy,*a;    // Current rows
+    int x,y;             // Iterators
+
+    for (y=begin; y<end; y++){
+        gx = &(*(*c).g).data[y*w];
+        gy = &(*(*c).g).data[n+y*w];
+        a = &(*(*c).acc).data[y*w];
+        for (x=0; x<w; x++){
+            gx[x] = a[x] > EPS_WEIGHT ? gx[x]/a[x] : 0.0;
+            gy[x] = a[x] > EPS_WEIGHT ? gy[x]/a[x] : 0.0;
+        }
+    }
+}
+
+/*
+ * Divergence row kernel (periodic backward differences of the
+ * normalized gradients).
+ */
+static void divergenceRows(void *ctx, int begin, int end){
+    div_ctx *c = (div_ctx*)ctx;
+    int h = (*(*c).f).height;
+    int w = (*(*c).f).width;
+    float *gx,*gy,*up,*f; // Current rows
+    int x,y;              // Iterators
+
+    for (y=begin; y<end; y++){
+        gx = &(*(*c).g).data[y*w];
+        gy = &(*(*c).g).data[h*w+y*w];
+        up = &(*(*c).g).data[h*w+((y+h-1)%h)*w];
+        f = &(*(*c).f).data[y*w];
+        f[0] = gx[0]-gx[w-1]+gy[0]-up[0];
+        for (x=1; x<w; x++){
+            f[x] = gx[x]-gx[x-1]+gy[x]-up[x];
+        }
+    }
+}
+
+/*
+ * This creates tiled output images from a set of already
+ * scaled, aligned tiles by gradient-domain blending (see
+ * tileImagesPatch).  The tiles' forward difference gradients
+ * are blended with the usual masked average and the output is
+ * the periodic Poisson solution whose gradients best match
+ * them, started from (and keeping the mean of) the ordinary
+ * weighted average.  Channels are blended and solved one at a
+ * time in place, so besides the outputs only about four
+ * full-size planes are needed at once.
+ *
+ * Inputs:
+ *     dsts - The output tiled images (modified)
+ *     tiles - The scaled tiles (see tileSize)
+ *     n - The number of tiles
+ *     normals - Flags marking normal maps (or NULL for none)
+ *     height - The output image height
+ *     width - The output image width
+ *     args - Shaping arguments (see tileImage)
+ */
+void poissonBlend(image_f *dsts, image_f *tiles, int n, int *normals, int height, int width, tile_args args){
+    image_f acc;        // Accumulated weights
+    image_f grad;       // Gradient tile of one channel (x plane then y plane)
+    image_f gdst;       // Blended gradients of one channel
+    image_f u,f;        // Output channel (a view into dsts) and its divergence
+    tile_args gargs;    // Gradient blending arguments
+    div_ctx c;          // Divergence context
+    float bg,v;         // Background value and mean shift
+    double mean,solved; // Means of the averaged and solved channel
+    float *in;          // Current tile channel
+    int tH,tW;          // Tile boundaries
+    int hw = height*width;
+    int k,z,i,x,y;      // Iterators
+
+    // Weighted average (the initial guess and mean)
+    tileAccumulate(dsts,&acc,tiles,n,height,width,args);
+    for (k=0; k<n; k++){
+        for (z=0; z<dsts[k].depth; z++){
+            bg = z == 0 ? args.bgColor.r : (z == 1 ? args.bgColor.g : (z == 2 ? args.bgColor.b : 0.0));
+            for (i=0; i<hw; i++){
+                dsts[k].data[z*hw+i] = acc.data[i] > EPS_WEIGHT ? dsts[k].data[z*hw+i]/acc.data[i] : bg;
+            }
+        }
+    }
+    dealloc_image(&acc);
+
+    // Blend gradients without any background
+    gargs = args;
+    gargs.bgColor.r = 0; gargs.bgColor.g = 0; gargs.bgColor.b = 0;
+    tH = tiles[0].height; tW = tiles[0].width;
+    alloc_image(&grad,tH,tW,2);
+    alloc_image(&f,height,width,1);
+    c.f = &f;
+    c.g = &gdst;
+    c.acc = &acc;
+
+    for (k=0; k<n; k++){
+        for (z=0; z<tiles[k].depth; z++){
+            // Forward difference gradients of the tile channel
+            in = &tiles[k].data[z*tH*tW];
+            for (y=0; y<tH; y++){
+                for (x=0; x<tW; x++){
+                    i = y*tW+x;
+                    grad.data[i] = x+1 < tW ? in[i+1]-in[i] : 0.0;
+                    grad.data[tH*tW+i] = y+1 < tH ? in[i+tW]-in[i] : 0.0;
+                }
+            }
+
+            // Blend them and take their divergence
+            tileAccumulate(&gdst,&acc,&grad,1,height,width,gargs);
+            parallel_for(height,normalizeRows,&c);
+            parallel_for(height,divergenceRows,&c);
+            dealloc_image(&gdst);
+            dealloc_image(&acc);
+
+            // Solve in place for the output channel
+            u.data = &dsts[k].data[z*hw];
+            u.height = height; u.width = width; u.depth = 1;
+            mean = 0;
+            for (i=0; i<hw; i++){
+                mean += u.data[i];
+            }
+            poisson_solve(&u,&f);
+
+            // Restore the mean and clamp
+            solved = 0;
+            for (i=0; i<hw; i++){
+                solved += u.data[i];
+            }
+            v = (mean-solved)/hw;
+            for (i=0; i<hw; i++){
+                u.data[i] = u.data[i]+v < 0.0 ? 0.0 : (u.data[i]+v > 1.0 ? 1.0 : u.data[i]+v);
+            }
+        }
+
+        // Renormalize normal maps
+        if (normals && normals[k]){
+            tileRenormalize(&dsts[k]);
+        }
+    }
+
+    // Deallocate
+    dealloc_image(&grad);
+    dealloc_image(&f);
+}
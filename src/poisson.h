@@ -0,0 +1,21 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * *
+ * Predefinitions of gradient-domain (Poisson)
+ * blending operations.
+ *
+ * Author: Michael Dushkoff (mad1841@rit.edu)
+ * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "image.h"
+#include "tile.h"
+
+// POISSON_H_
+#ifndef POISSON_H_
+#define POISSON_H_
+
+/**** Solver operations ****/
+int poisson_solve(image_f *u, image_f *f);
+
+/**** Blending operations ****/
+void poissonBlend(image_f *dsts, image_f *tiles, int n, int *normals, int height, int width, tile_args args);
+
+#endif // END POISSON_H_
@@ -0,0 +1,777 @@
+/*
+ * This performs multi-band (Laplacian pyramid) blending of
+ * tile placements.  Every frequency band of the tiles is
+ * blended separately with a correspondingly blurred mask, so
+ * low frequencies are blended over wide transitions while
+ * detail is blended over narrow ones.
+ *
+ * Author: Michael Dushkoff (mad1841@rit.edu)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "pyramid.h"
+#include "thread.h"
+
+// Definitions
+#define MAX_LEVELS (8)       // Maximum number of pyramid levels
+#define MIN_TILE_LEVEL (8)   // Smallest tile size at the coarsest level
+#define EPS_WEIGHT (1e-6)    // Accumulated weight considered uncovered
+
+/**** Structure declarations ****/
+typedef struct{
+    int oy;                  // Padded origin relative to the placement offset
+    int ox;
+    int height;              // Padded size
+    int width;
+    image_f *pyr;            // Per plane pyramids [q*(levels+1)+l]
+    int r0[MAX_LEVELS+1];    // Mask support per level
+    int r1[MAX_LEVELS+1];
+    int c0[MAX_LEVELS+1];
+    int c1[MAX_LEVELS+1];
+} phase_pyr;
+
+typedef struct{
+    tile_plan *plan;         // Placement plan
+    image_f *tiles;          // Scaled tiles
+    int *planeMap;           // Map of each plane (plane 0 is the mask)
+    int *planeZ;             // Channel of each plane
+    int planes;              // Number of planes (mask and all map channels)
+    int levels;              // Coarsest level
+    int periodic;            // Coarsest level the output halves evenly to
+    int level;               // Level accumulated by accumulateLevel
+    image_f *tmp;            // Accumulated planes of that level
+    image_f *coarse;         // Blended channel bands coarser than periodic (or NULL)
+    int numPhases;
+    phase_pyr *phases;
+    int *phaseOf;            // Phase of each placement
+    image_f *acc;            // Accumulated pyramids [q*(periodic+1)+l]
+    image_f *dsts;           // Output images
+    tile_args args;
+} blend_ctx;
+
+/*
+ * This maps a coordinate onto an image row or column, either
+ * wrapping around or reflecting at the borders.
+ *
+ * Inputs:
+ *     i - The coordinate
+ *     n - The number of rows or columns
+ *     wrap - Whether to wrap (otherwise reflect)
+ * Outputs:
+ *     i - The mapped coordinate
+ */
+static int border(int i, int n, int wrap){
+    if (wrap){
+        i %= n;
+        return i < 0 ? i+n : i;
+    }
+    i %= 2*n;
+    i = i < 0 ? i+2*n : i;
+    return i < n ? i : 2*n-1-i;
+}
+
+/*
+ * This reduces an image to half its size with a separable
+ * 5-tap binomial filter and stores that into an unallocated
+ * image pointer.
+ *
+ * Inputs:
+ *     dst - The reduced image (modified)
+ *     src - The image to reduce (with even height and width)
+ *     wrap - Whether the image wraps (otherwise it reflects)
+ */
+void pyramid_reduce(image_f *dst, image_f *src, int wrap){
+    int x,y,z;       // Iterators
+    int c;           // Source column
+    int h,w,h2,w2;   // Boundaries
+    float *tmp;      // Horizontally reduced plane
+    float *row,*t;   // Current rows
+    float *r0,*r1,*r2,*r3,*r4; // Vertical filter rows
+    float *out;      // Output row
+
+    // Save boundaries
+    h = (*src).height; w = (*src).width;
+    h2 = h/2; w2 = w/2;
+    if (h%2 || w%2){
+        perror_("ERROR: Image sizes must be even to reduce.");
+    }
+    alloc_image(dst,h2,w2,(*src).depth);
+    tmp = (float*)malloc(sizeof(float)*h*w2);
+    if (!tmp){
+        perror_("ERROR: Pyramid allocation failed.");
+    }
+
+    for (z=0; z<(*src).depth; z++){
+        // Filter and decimate rows
+        for (y=0; y<h; y++){
+            row = &(*src).data[z*h*w+y*w];
+            t = &tmp[y*w2];
+            for (x=0; x<w2; x++){
+                c = 2*x;
+                if (c >= 2 && c+2 < w){
+                    t[x] = 0.0625f*(row[c-2]+row[c+2])+0.25f*(row[c-1]+row[c+1])+0.375f*row[c];
+                }
+                else{
+                    t[x] = 0.0625f*(row[border(c-2,w,wrap)]+row[border(c+2,w,wrap)])+
+                           0.25f*(row[border(c-1,w,wrap)]+row[border(c+1,w,wrap)])+
+                           0.375f*row[c];
+                }
+            }
+        }
+
+        // Filter and decimate columns
+        for (y=0; y<h2; y++){
+            r0 = &tmp[border(2*y-2,h,wrap)*w2];
+            r1 = &tmp[border(2*y-1,h,wrap)*w2];
+            r2 = &tmp[2*y*w2];
+            r3 = &tmp[border(2*y+1,h,wrap)*w2];
+            r4 = &tmp[border(2*y+2,h,wrap)*w2];
+            out = &(*dst).data[z*h2*w2+y*w2];
+            for (x=0; x<w2; x++){
+                out[x] = 0.0625f*(r0[x]+r4[x])+0.25f*(r1[x]+r3[x])+0.375f*r2[x];
+            }
+        }
+    }
+
+    free(tmp);
+}
+
+/*
+ * This expands an image to twice its size with a separable
+ * 5-tap binomial filter and adds it to another image.
+ *
+ * Inputs:
+ *     dst - The image to add to (twice the size of src) (modified)
+ *     src - The image to expand
+ *     sign - The factor to add the expanded image with
+ *     wrap - Whether the image wraps (otherwise it reflects)
+ */
+void pyramid_expandAdd(image_f *dst, image_f *src, float sign, int wrap){
+    int x,y,z;       // Iterators
+    int h,w,h2,w2;   // Boundaries (h2,w2 are the source sizes)
+    float *tmp;      // Vertically expanded plane
+    float *t,*out;   // Current rows
+    float *r0,*r1,*r2; // Vertical filter rows
+    float a,b;       // Neighboring values
+
+    // Save boundaries
+    h2 = (*src).height; w2 = (*src).width;
+    h = (*dst).height; w = (*dst).width;
+    if (h != 2*h2 || w != 2*w2 || (*dst).depth != (*src).depth){
+        perror_("ERROR: Image sizes do not match.");
+    }
+    tmp = (float*)malloc(sizeof(float)*h*w2);
+    if (!tmp){
+        perror_("ERROR: Pyramid allocation failed.");
+    }
+
+    for (z=0; z<(*src).depth; z++){
+        // Interpolate rows
+        for (y=0; y<h2; y++){
+            r0 = &(*src).data[z*h2*w2+border(y-1,h2,wrap)*w2];
+            r1 = &(*src).data[z*h2*w2+y*w2];
+            r2 = &(*src).data[z*h2*w2+border(y+1,h2,wrap)*w2];
+            for (x=0; x<w2; x++){
+                tmp[2*y*w2+x] = 0.125f*(r0[x]+r2[x])+0.75f*r1[x];
+                tmp[(2*y+1)*w2+x] = 0.5f*(r1[x]+r2[x]);
+            }
+        }
+
+        // Interpolate columns and add
+        for (y=0; y<h; y++){
+            t = &tmp[y*w2];
+            out = &(*dst).data[z*h*w+y*w];
+            for (x=0; x<w2; x++){
+                a = x > 0 ? t[x-1] : t[border(x-1,w2,wrap)];
+                b = x+1 < w2 ? t[x+1] : t[border(x+1,w2,wrap)];
+                out[2*x] += sign*(0.125f*(a+b)+0.75f*t[x]);
+                out[2*x+1] += sign*(0.5f*(t[x]+b));
+            }
+        }
+    }
+
+    free(tmp);
+}
+
+/*
+ * This chooses the number of pyramid levels, keeping the tile
+ * reasonably large at the coarsest level.  (Levels which the
+ * output size does not halve evenly to are blended at a finer
+ * level, see pyramidBlend.)
+ *
+ * Inputs:
+ *     height - The output image height
+ *     width - The output image width
+ *     tH - The tile height
+ *     tW - The tile width
+ *     requested - The requested number of levels (0 implies automatic)
+ * Outputs:
+ *     levels - The coarsest level (0 implies a single band)
+ */
+int pyramidLevels(int height, int width, int tH, int tW, int requested){
+    int L = requested > 0 && requested < MAX_LEVELS ? requested : MAX_LEVELS;
+    int t = tH < tW ? tH : tW;
+
+    while (L > 0 && (t>>L) < MIN_TILE_LEVEL){
+        L--;
+    }
+    return L;
+}
+
+/*
+ * This builds the pyramids of one plane for a range of
+ * (phase, plane) pairs.  Plane 0 is the Gaussian pyramid of
+ * the zero padded mask and every other plane is the Laplacian
+ * pyramid of a reflection padded tile channel.
+ *
+ * Inputs:
+ *     ctx - The blending context
+ *     begin - The first pair
+ *     end - One past the last pair
+ */
+static void buildPhases(void *ctx, int begin, int end){
+    blend_ctx *c = (blend_ctx*)ctx;
+    phase_pyr *ph;   // Current phase
+    image_f *pyr;    // Current plane pyramid
+    image_f *tile;   // Current tile
+    float *in;       // Current tile plane
+    int L = (*c).levels;
+    int tH = (*(*c).plan).mask.height;
+    int tW = (*(*c).plan).mask.width;
+    int p,q,l,x,y;   // Iterators
+    int ty,tx;       // Tile coordinates
+
+    for (p=begin; p<end; p++){
+        ph = &(*c).phases[p/(*c).planes];
+        q = p%(*c).planes;
+        pyr = &(*ph).pyr[q*(L+1)];
+
+        // Create padded level 0
+        alloc_image(&pyr[0],(*ph).height,(*ph).width,1);
+        if (q == 0){
+            in = (*(*c).plan).mask.data;
+        }
+        else{
+            tile = &(*c).tiles[(*c).planeMap[q]];
+            in = &(*tile).data[(*c).planeZ[q]*tH*tW];
+        }
+        for (y=0; y<(*ph).height; y++){
+            for (x=0; x<(*ph).width; x++){
+                ty = y+(*ph).oy;
+                tx = x+(*ph).ox;
+                if (q == 0){
+                    pyr[0].data[y*(*ph).width+x] = (ty >= 0 && ty < tH && tx >= 0 && tx < tW) ?
+                                                   in[ty*tW+tx] : 0.0;
+                }
+                else{
+                    pyr[0].data[y*(*ph).width+x] = in[border(ty,tH,0)*tW+border(tx,tW,0)];
+                }
+            }
+        }
+
+        // Build Gaussian levels (turned into Laplacian levels for channels)
+        for (l=0; l<L; l++){
+            pyramid_reduce(&pyr[l+1],&pyr[l],0);
+            if (q != 0){
+                pyramid_expandAdd(&pyr[l],&pyr[l+1],-1.0,0);
+            }
+        }
+    }
+}
+
+/*
+ * This expands an image a number of times in place (without
+ * wrapping).
+ *
+ * Inputs:
+ *     img - The image to expand (modified)
+ *     n - The number of times to expand it
+ */
+static void expandBy(image_f *img, int n){
+    image_f big;  // Expanded image
+
+    for (; n>0; n--){
+        alloc_image(&big,2*(*img).height,2*(*img).width,(*img).depth);
+        image_fill(&big,0.0);
+        pyramid_expandAdd(&big,img,1.0,0);
+        dealloc_image(img);
+        *img = big;
+    }
+}
+
+/*
+ * This weights every channel band coarser than the periodic
+ * level by the mask and expands it to the periodic level for
+ * a range of (phase, channel plane) pairs.
+ *
+ * Inputs:
+ *     ctx - The blending context
+ *     begin - The first pair
+ *     end - One past the last pair
+ */
+static void expandBands(void *ctx, int begin, int end){
+    blend_ctx *c = (blend_ctx*)ctx;
+    phase_pyr *ph;   // Current phase
+    image_f *band;   // Current band
+    int L = (*c).levels;
+    int V = (*c).periodic;
+    int p,q,l;       // Iterators
+
+    for (p=begin; p<end; p++){
+        ph = &(*c).phases[p/((*c).planes-1)];
+        q = 1+p%((*c).planes-1);
+        for (l=V+1; l<=L; l++){
+            band = &(*ph).pyr[q*(L+1)+l];
+            image_mul(band,&(*ph).pyr[l]);
+            expandBy(band,l-V);
+        }
+    }
+}
+
+/*
+ * This expands every mask level coarser than the periodic
+ * level to it for a range of phases (after expandBands).
+ *
+ * Inputs:
+ *     ctx - The blending context
+ *     begin - The first phase
+ *     end - One past the last phase
+ */
+static void expandMasks(void *ctx, int begin, int end){
+    blend_ctx *c = (blend_ctx*)ctx;
+    int L = (*c).levels;
+    int V = (*c).periodic;
+    int p,l;         // Iterators
+
+    for (p=begin; p<end; p++){
+        for (l=V+1; l<=L; l++){
+            expandBy(&(*c).phases[p].pyr[l],l-V);
+        }
+    }
+}
+
+/*
+ * This accumulates one level of one plane of every placement
+ * into a wrapped output plane.  Plane 0 accumulates the mask
+ * weights and every other plane the masked channel band
+ * (bands coarser than the periodic level are stored at that
+ * level and are already masked).
+ *
+ * Inputs:
+ *     c - The blending context
+ *     dst - The output plane (modified)
+ *     l - The level
+ *     q - The plane
+ */
+static void addBand(blend_ctx *c, image_f *dst, int l, int q){
+    tile_plan *plan = (*c).plan;
+    phase_pyr *ph;    // Current phase
+    float *m,*in;     // Mask and band rows
+    float *out;       // Output row
+    int L = (*c).levels;
+    int s = l < (*c).periodic ? l : (*c).periodic; // Level the band is stored at
+    int masked = q != 0 && l <= (*c).periodic;     // Whether to weight by the mask
+    int o,a,b,x,y;    // Iterators
+    int h,w,pw;       // Boundaries
+    int oy,ox;        // Placement origin at this level
+    int ySeg[3*4],xSeg[3*4]; // Non-wrapping segments
+    int *yS,*xS;      // Segment storage (when larger than the defaults)
+    int ny,nx;        // Number of segments
+    int r0,r1,c0,c1;  // Mask support
+
+    h = (*dst).height; w = (*dst).width;
+    for (o=0; o<(*plan).count; o++){
+        ph = &(*c).phases[(*c).phaseOf[o]];
+        r0 = (*ph).r0[l]; r1 = (*ph).r1[l];
+        c0 = (*ph).c0[l]; c1 = (*ph).c1[l];
+        if (r0 >= r1 || c0 >= c1){
+            continue;
+        }
+        pw = (*ph).pyr[l].width;
+        oy = ((*plan).yoff[o]+(*ph).oy)/(1<<s);
+        ox = ((*plan).xoff[o]+(*ph).ox)/(1<<s);
+
+        // Split the support into non-wrapping segments
+        yS = (r1-r0)/h+2 <= 4 ? ySeg : (int*)malloc(sizeof(int)*3*((r1-r0)/h+2));
+        xS = (c1-c0)/w+2 <= 4 ? xSeg : (int*)malloc(sizeof(int)*3*((c1-c0)/w+2));
+        if (!yS || !xS){
+            perror_("ERROR: Segment allocation failed.");
+        }
+        ny = tileSegments(yS,oy+r0,r1-r0,h);
+        nx = tileSegments(xS,ox+c0,c1-c0,w);
+
+        // Accumulate the band
+        for (a=0; a<ny; a++){
+            for (y=0; y<yS[3*a+2]; y++){
+                for (b=0; b<nx; b++){
+                    m = &(*ph).pyr[l].data[(r0+yS[3*a]+y)*pw+c0+xS[3*b]];
+                    in = &(*ph).pyr[q*(L+1)+l].data[(r0+yS[3*a]+y)*pw+c0+xS[3*b]];
+                    out = &(*dst).data[(yS[3*a+1]+y)*w+xS[3*b+1]];
+                    if (masked){
+                        for (x=0; x<xS[3*b+2]; x++){
+                            out[x] += m[x]*in[x];
+                        }
+                    }
+                    else{
+                        for (x=0; x<xS[3*b+2]; x++){
+                            out[x] += in[x];
+                        }
+                    }
+                }
+            }
+        }
+
+        if (yS != ySeg){
+            free(yS);
+        }
+        if (xS != xSeg){
+            free(xS);
+        }
+    }
+}
+
+/*
+ * This accumulates every placement into the output pyramids
+ * for a range of (level, plane) pairs up to the periodic level
+ * (see addBand).
+ *
+ * Inputs:
+ *     ctx - The blending context
+ *     begin - The first pair
+ *     end - One past the last pair
+ */
+static void accumulateBands(void *ctx, int begin, int end){
+    blend_ctx *c = (blend_ctx*)ctx;
+    int V = (*c).periodic;
+    int p,q,l;       // Iterators
+
+    for (p=begin; p<end; p++){
+        l = p/(*c).planes;
+        q = p%(*c).planes;
+        addBand(c,&(*c).acc[q*(V+1)+l],l,q);
+    }
+}
+
+/*
+ * This accumulates every placement of one level coarser than
+ * the periodic level for a range of planes (see addBand).
+ *
+ * Inputs:
+ *     ctx - The blending context
+ *     begin - The first plane
+ *     end - One past the last plane
+ */
+static void accumulateLevel(void *ctx, int begin, int end){
+    blend_ctx *c = (blend_ctx*)ctx;
+    int q;           // Iterator
+
+    for (q=begin; q<end; q++){
+        addBand(c,&(*c).tmp[q],(*c).level,q);
+    }
+}
+
+/*
+ * This normalizes one accumulated level coarser than the
+ * periodic level for a range of channel planes and adds it to
+ * their coarse bands.
+ *
+ * Inputs:
+ *     ctx - The blending context
+ *     begin - The first channel plane
+ *     end - One past the last channel plane
+ */
+static void normalizeLevel(void *ctx, int begin, int end){
+    blend_ctx *c = (blend_ctx*)ctx;
+    float *num,*den,*out; // Accumulated band, weights and coarse band
+    float bg;             // Background value
+    int p,i,n,z;          // Iterators
+
+    for (p=begin; p<end; p++){
+        z = (*c).planeZ[p+1];
+        bg = z == 0 ? (*c).args.bgColor.r : (z == 1 ? (*c).args.bgColor.g : (z == 2 ? (*c).args.bgColor.b : 0.0));
+        bg = (*c).level == (*c).levels ? bg : 0.0;
+        num = (*c).tmp[p+1].data;
+        den = (*c).tmp[0].data;
+        out = (*c).coarse[p].data;
+        n = (*c).tmp[0].height*(*c).tmp[0].width;
+        for (i=0; i<n; i++){
+            out[i] += den[i] > EPS_WEIGHT ? num[i]/den[i] : bg;
+        }
+    }
+}
+
+/*
+ * This normalizes every band of a range of channel planes and
+ * collapses them into the output images.
+ *
+ * Inputs:
+ *     ctx - The blending context
+ *     begin - The first plane
+ *     end - One past the last plane
+ */
+static void collapseBands(void *ctx, int begin, int end){
+    blend_ctx *c = (blend_ctx*)ctx;
+    image_f *band;   // Current band
+    image_f *den;    // Accumulated weights
+    float bg;        // Background value
+    float v;         // Output value
+    float *out;      // Output plane
+    int L = (*c).levels;
+    int V = (*c).periodic;
+    int p,q,l,i,n,z; // Iterators
+
+    for (p=begin; p<end; p++){
+        q = p+1; // Skip the mask plane
+        z = (*c).planeZ[q];
+        bg = z == 0 ? (*c).args.bgColor.r : (z == 1 ? (*c).args.bgColor.g : (z == 2 ? (*c).args.bgColor.b : 0.0));
+
+        for (l=V; l>=0; l--){
+            // Normalize band (uncovered areas fall back to the background)
+            band = &(*c).acc[q*(V+1)+l];
+            den = &(*c).acc[l];
+            n = (*band).height*(*band).width;
+            for (i=0; i<n; i++){
+                if ((*den).data[i] > EPS_WEIGHT){
+                    (*band).data[i] = (*band).data[i]/(*den).data[i];
+                }
+                else{
+                    (*band).data[i] = l == L ? bg : 0.0;
+                }
+            }
+
+            // Add the coarser levels
+            if (l < V){
+                pyramid_expandAdd(band,&(*c).acc[q*(V+1)+l+1],1.0,1);
+            }
+            else if ((*c).coarse){
+                image_add(band,&(*c).coarse[p]);
+            }
+        }
+
+        // Copy (clamped) result into the output
+        band = &(*c).acc[q*(V+1)];
+        n = (*band).height*(*band).width;
+        out = &(*c).dsts[(*c).planeMap[q]].data[z*n];
+        for (i=0; i<n; i++){
+            v = (*band).data[i];
+            out[i] = v < 0.0 ? 0.0 : (v > 1.0 ? 1.0 : v);
+        }
+    }
+}
+
+/*
+ * This creates tiled output images from a set of already
+ * scaled, aligned tiles by multi-band blending (see
+ * tileImagesPatch).  The tiles' pyramids are built once per
+ * placement phase (the placement offset modulo the periodic
+ * level's scale, usually the same for every placement) on a
+ * reflection padded tile, and each band is accumulated into
+ * wrapped output pyramids weighted by the mask's Gaussian
+ * pyramid.  Pyramid construction, accumulation and collapse
+ * are split across threads by level and plane.
+ *
+ * Output levels only wrap exactly while the output size halves
+ * evenly, so bands coarser than that (periodic) level, e.g.
+ * every band but the finest for odd sizes, are weighted by the
+ * mask in tile space, expanded to the periodic level and
+ * accumulated and normalized there, one level at a time.
+ *
+ * Inputs:
+ *     dsts - The output tiled images (modified)
+ *     tiles - The scaled tiles (see tileSize)
+ *     n - The number of tiles
+ *     normals - Flags marking normal maps (or NULL for none)
+ *     height - The output image height
+ *     width - The output image width
+ *     args - Shaping arguments (see tileImage)
+ */
+void pyramidBlend(image_f *dsts, image_f *tiles, int n, int *normals, int height, int width, tile_args args){
+    blend_ctx c;      // Blending context
+    tile_plan plan;   // Placement plan
+    phase_pyr *ph;    // Current phase
+    image_f *mask;    // Current mask level
+    int tH,tW;        // Tile heights and widths
+    int L,V,S,A,P;    // Coarsest and periodic levels, their scales and the padding
+    int oy,ox;        // Padded origin (multiple of A)
+    int k,z,q,l,o,i;  // Iterators
+    int x,y;          // Iterators
+
+    // Fall back to a single band when the tile is too small for levels
+    tH = tiles[0].height; tW = tiles[0].width;
+    L = pyramidLevels(height,width,tH,tW,args.levels);
+    if (L == 0){
+        args.blend = BLEND_AVERAGE;
+        tileImagesPatch(dsts,tiles,n,normals,height,width,args);
+        return;
+    }
+    V = L;
+    while (V > 0 && (height%(1<<V) || width%(1<<V))){
+        V--;
+    }
+    S = 1<<L;
+    A = 1<<V; // Placements only need to align with the periodic level
+    P = 2*S;  // Covers the spread of the mask up to the coarsest level
+
+    // Create placement plan
+    tilePlan(&plan,tH,tW,height,width,args);
+    c.plan = &plan;
+    c.tiles = tiles;
+    c.levels = L;
+    c.periodic = V;
+    c.coarse = NULL;
+    c.dsts = dsts;
+    c.args = args;
+
+    // Enumerate planes (the mask followed by every map channel)
+    c.planes = 1;
+    for (k=0; k<n; k++){
+        c.planes += tiles[k].depth;
+    }
+    c.planeMap = (int*)malloc(sizeof(int)*c.planes);
+    c.planeZ = (int*)malloc(sizeof(int)*c.planes);
+    if (!c.planeMap || !c.planeZ){
+        perror_("ERROR: Plane allocation failed.");
+    }
+    c.planeMap[0] = -1; c.planeZ[0] = 0;
+    for (k=0,q=1; k<n; k++){
+        for (z=0; z<tiles[k].depth; z++,q++){
+            c.planeMap[q] = k;
+            c.planeZ[q] = z;
+        }
+    }
+
+    // Group placements by phase
+    c.phases = (phase_pyr*)malloc(sizeof(phase_pyr)*plan.count);
+    c.phaseOf = (int*)malloc(sizeof(int)*plan.count);
+    if (!c.phases || !c.phaseOf){
+        perror_("ERROR: Phase allocation failed.");
+    }
+    c.numPhases = 0;
+    for (o=0; o<plan.count; o++){
+        oy = plan.yoff[o]-P; oy = (oy >= 0 ? oy/A : -((-oy+A-1)/A))*A-plan.yoff[o];
+        ox = plan.xoff[o]-P; ox = (ox >= 0 ? ox/A : -((-ox+A-1)/A))*A-plan.xoff[o];
+        for (i=0; i<c.numPhases; i++){
+            if (c.phases[i].oy == oy && c.phases[i].ox == ox){
+                break;
+            }
+        }
+        if (i == c.numPhases){
+            ph = &c.phases[c.numPhases++];
+            (*ph).oy = oy;
+            (*ph).ox = ox;
+            (*ph).height = ((tH+P-oy+S-1)/S)*S;
+            (*ph).width = ((tW+P-ox+S-1)/S)*S;
+            (*ph).pyr = (image_f*)malloc(sizeof(image_f)*c.planes*(L+1));
+            if (!(*ph).pyr){
+                perror_("ERROR: Pyramid allocation failed.");
+            }
+        }
+        c.phaseOf[o] = i;
+    }
+
+    // Build tile pyramids (expanding levels coarser than the periodic one)
+    parallel_for(c.numPhases*c.planes,buildPhases,&c);
+    if (L > V){
+        parallel_for(c.numPhases*(c.planes-1),expandBands,&c);
+        parallel_for(c.numPhases,expandMasks,&c);
+    }
+
+    // Find the mask support per level
+    for (i=0; i<c.numPhases; i++){
+        ph = &c.phases[i];
+        for (l=0; l<=L; l++){
+            mask = &(*ph).pyr[l];
+            (*ph).r0[l] = (*mask).height; (*ph).r1[l] = 0;
+            (*ph).c0[l] = (*mask).width; (*ph).c1[l] = 0;
+            for (y=0; y<(*mask).height; y++){
+                for (x=0; x<(*mask).width; x++){
+                    if ((*mask).data[y*(*mask).width+x] > 0.0){
+                        (*ph).r0[l] = y < (*ph).r0[l] ? y : (*ph).r0[l];
+                        (*ph).r1[l] = y+1 > (*ph).r1[l] ? y+1 : (*ph).r1[l];
+                        (*ph).c0[l] = x < (*ph).c0[l] ? x : (*ph).c0[l];
+                        (*ph).c1[l] = x+1 > (*ph).c1[l] ? x+1 : (*ph).c1[l];
+                    }
+                }
+            }
+        }
+    }
+
+    // Create output pyramids
+    c.acc = (image_f*)malloc(sizeof(image_f)*c.planes*(V+1));
+    if (!c.acc){
+        perror_("ERROR: Pyramid allocation failed.");
+    }
+    for (q=0; q<c.planes; q++){
+        for (l=0; l<=V; l++){
+            alloc_image(&c.acc[q*(V+1)+l],height>>l,width>>l,1);
+            image_fill(&c.acc[q*(V+1)+l],0.0);
+        }
+    }
+    for (k=0; k<n; k++){
+        alloc_image(&dsts[k],height,width,tiles[k].depth);
+    }
+
+    // Blend the bands coarser than the periodic level one at a time
+    if (L > V){
+        c.tmp = (image_f*)malloc(sizeof(image_f)*c.planes);
+        c.coarse = (image_f*)malloc(sizeof(image_f)*(c.planes-1));
+        if (!c.tmp || !c.coarse){
+            perror_("ERROR: Pyramid allocation failed.");
+        }
+        for (q=0; q<c.planes; q++){
+            alloc_image(&c.tmp[q],height>>V,width>>V,1);
+            if (q > 0){
+                alloc_image(&c.coarse[q-1],height>>V,width>>V,1);
+                image_fill(&c.coarse[q-1],0.0);
+            }
+        }
+        for (c.level=V+1; c.level<=L; c.level++){
+            for (q=0; q<c.planes; q++){
+                image_fill(&c.tmp[q],0.0);
+            }
+            parallel_for(c.planes,accumulateLevel,&c);
+            parallel_for(c.planes-1,normalizeLevel,&c);
+        }
+        for (q=0; q<c.planes; q++){
+            dealloc_image(&c.tmp[q]);
+        }
+        free(c.tmp);
+    }
+
+    // Accumulate, normalize and collapse every band
+    parallel_for((V+1)*c.planes,accumulateBands,&c);
+    parallel_for(c.planes-1,collapseBands,&c);
+
+    // Renormalize normal maps
+    for (k=0; k<n; k++){
+        if (normals && normals[k]){
+            tileRenormalize(&dsts[k]);
+        }
+    }
+
+    // Deallocate
+    for (i=0; i<c.numPhases; i++){
+        for (q=0; q<c.planes*(L+1); q++){
+            dealloc_image(&c.phases[i].pyr[q]);
+        }
+        free(c.phases[i].pyr);
+    }
+    for (q=0; q<c.planes*(V+1); q++){
+        dealloc_image(&c.acc[q]);
+    }
+    free(c.acc);
+    if (c.coarse){
+        for (q=0; q<c.planes-1; q++){
+            dealloc_image(&c.coarse[q]);
+        }
+        free(c.coarse);
+    }
+    free(c.phases);
+    free(c.phaseOf);
+    free(c.planeMap);
+    free(c.planeZ);
+    freePlan(&plan);
+}
@@ -0,0 +1,23 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * *
+ * Predefinitions of multi-band (Laplacian pyramid)
+ * blending operations.
+ *
+ * Author: Michael Dushkoff (mad1841@rit.edu)
+ * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "image.h"
+#include "tile.h"
+
+// PYRAMID_H_
+#ifndef PYRAMID_H_
+#define PYRAMID_H_
+
+/**** Pyramid operations ****/
+void pyramid_reduce(image_f *dst, image_f *src, int wrap);
+void pyramid_expandAdd(image_f *dst, image_f *src, float sign, int wrap);
+int pyramidLevels(int height, int width, int tH, int tW, int requested);
+
+/**** Blending operations ****/
+void pyramidBlend(image_f *dsts, image_f *tiles, int n, int *normals, int height, int width, tile_args args);
+
+#endif // END PYRAMID_H_
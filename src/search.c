@@ -0,0 +1,295 @@
+/*
+ * This searches for shaping parameters (octave, tile size
+ * and blur) by tiling a low resolution proxy of the source
+ * with every candidate and scoring the results.
+ *
+ * Author: Michael Dushkoff (mad1841@rit.edu)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "search.h"
+#include "thread.h"
+
+// Definitions
+#define PROXY_SIZE (128)       // Largest proxy dimension
+#define LOW_WEIGHT (0.05)      // Accumulated weight considered uncovered
+#define COVERAGE_WEIGHT (4.0)  // Score penalty for uncovered area
+
+// Wrapping macro definition
+#define wrp(x,y) (x%y>=0?x%y:y+x%y)
+
+// Candidate parameter grid (tile sizes are relative to one octave cell)
+static const int octaves[] = {1,2,3};
+static const float sizes[] = {1.0,1.25,1.5,2.0};
+static const float blurs[] = {0.1,0.15,0.2,0.3,0.5,0.75,1.0};
+
+#define NUM_OCTAVES (sizeof(octaves)/sizeof(octaves[0]))
+#define NUM_SIZES (sizeof(sizes)/sizeof(sizes[0]))
+#define NUM_BLURS (sizeof(blurs)/sizeof(blurs[0]))
+
+/**** Structure declarations ****/
+typedef struct{
+    image_f *proxy;   // Low resolution source
+    tile_args base;   // Arguments not being searched
+    int factor;       // Proxy shrinking factor
+    float srcGrad;    // Mean proxy gradient magnitude
+    float *scores;    // Score per candidate
+} search_ctx;
+
+/*
+ * This counts the candidates on the grid of searched
+ * parameters.
+ *
+ * Inputs:
+ *     search - The parameters to search for (see SEARCH_ALL)
+ * Outputs:
+ *     n - The number of candidates
+ */
+static int candidateCount(int search){
+    return ((search & SEARCH_OCTAVE) ? NUM_OCTAVES : 1)*
+           ((search & SEARCH_SIZE) ? NUM_SIZES : 1)*
+           ((search & SEARCH_BLUR) ? NUM_BLURS : 1);
+}
+
+/*
+ * This sets the searched arguments of the given candidate,
+ * leaving the others as given.  An explicit tile size is
+ * shrunk along with the image.
+ *
+ * Inputs:
+ *     args - The argument structure (modified)
+ *     c - The candidate index
+ *     height - The output image height
+ *     width - The output image width
+ *     factor - The shrinking factor of the image
+ */
+static void candidateArgs(tile_args *args, int c, int height, int width, int factor){
+    int search = (*args).autoTune;
+    int nS = (search & SEARCH_SIZE) ? NUM_SIZES : 1;
+    int nB = (search & SEARCH_BLUR) ? NUM_BLURS : 1;
+    int v;
+
+    if (search & SEARCH_OCTAVE){
+        (*args).octave = octaves[c/(nS*nB)];
+    }
+    if (search & SEARCH_BLUR){
+        (*args).blur = blurs[c%nB];
+    }
+    if (search & SEARCH_SIZE){
+        v = pow(2,(*args).octave);
+        (*args).pHeight = (int)(sizes[(c/nB)%nS]*height/v+0.5);
+        (*args).pWidth = (int)(sizes[(c/nB)%nS]*width/v+0.5);
+    }
+    else{
+        (*args).pHeight = (*args).pHeight > 0 ? (int)((float)(*args).pHeight/factor+0.5) : -1;
+        (*args).pWidth = (*args).pWidth > 0 ? (int)((float)(*args).pWidth/factor+0.5) : -1;
+    }
+}
+
+/*
+ * This calculates the mean gradient magnitude of an image
+ * (summed over channels).
+ *
+ * Inputs:
+ *     img - The given image
+ * Outputs:
+ *     grad - The mean gradient magnitude
+ */
+static float meanGradient(image_f *img){
+    int x,y,z;  // Iterators
+    int i;      // Exact coordinate
+    int h = (*img).height;
+    int w = (*img).width;
+    double sum = 0;
+
+    for (z=0; z<(*img).depth; z++){
+        for (y=0; y<h-1; y++){
+            for (x=0; x<w-1; x++){
+                i = z*h*w+y*w+x;
+                sum += fabs((*img).data[i+1]-(*img).data[i])+
+                       fabs((*img).data[i+w]-(*img).data[i]);
+            }
+        }
+    }
+    return h > 1 && w > 1 ? sum/((h-1)*(w-1)) : 0;
+}
+
+/*
+ * This scores an unnormalized tiled image using its
+ * accumulated weights, where lower is better.  The score
+ * sums three terms:
+ *     seam - Excess output gradient where the weights change
+ *            quickly (i.e. where placements hand over)
+ *     detail - Loss of output gradient compared to the source
+ *     coverage - Fraction of pixels with little weight
+ * All gradients wrap so that the tiling seam is included.
+ *
+ * Inputs:
+ *     dst - The unnormalized tiled image (see tileAccumulate)
+ *     acc - The accumulated weights
+ *     srcGrad - The mean gradient magnitude of the source
+ * Outputs:
+ *     score - The tiling score
+ */
+float scoreTiling(image_f *dst, image_f *acc, float srcGrad){
+    int x,y,z;        // Iterators
+    int i,ix,iy;      // Exact coordinates
+    int h = (*dst).height;
+    int w = (*dst).width;
+    int n = h*w;
+    float a,ax,ay;    // Weights at pixel and neighbors
+    float r,g;        // Relative weight change and output gradient
+    double seamNum = 0, seamDen = 0, gradSum = 0;
+    int low = 0, counted = 0;
+    float seam,detail;
+
+    for (y=0; y<h; y++){
+        for (x=0; x<w; x++){
+            i = y*w+x;
+            ix = y*w+wrp((x+1),w);
+            iy = wrp((y+1),h)*w+x;
+            a = (*acc).data[i]; ax = (*acc).data[ix]; ay = (*acc).data[iy];
+
+            // Uncovered pixels only count against coverage
+            if (a < LOW_WEIGHT){
+                low++;
+                continue;
+            }
+            if (ax < LOW_WEIGHT || ay < LOW_WEIGHT){
+                continue;
+            }
+
+            // Normalized output gradient
+            g = 0;
+            for (z=0; z<(*dst).depth; z++){
+                g += fabs((*dst).data[z*n+ix]/ax-(*dst).data[z*n+i]/a)+
+                     fabs((*dst).data[z*n+iy]/ay-(*dst).data[z*n+i]/a);
+            }
+            r = (fabs(ax-a)+fabs(ay-a))/a;
+            seamNum += r*g;
+            seamDen += r;
+            gradSum += g;
+            counted++;
+        }
+    }
+
+    // Combine terms relative to the source gradient
+    if (srcGrad <= 0 || counted == 0){
+        return COVERAGE_WEIGHT*(float)low/(float)n;
+    }
+    seam = seamDen > 0 ? (seamNum/seamDen)/srcGrad-1.0 : 0;
+    detail = 1.0-(gradSum/counted)/srcGrad;
+    return (seam > 0 ? seam : 0)+(detail > 0 ? detail : 0)+COVERAGE_WEIGHT*(float)low/(float)n;
+}
+
+/*
+ * This tiles the proxy with a range of candidates and scores
+ * each of them.
+ *
+ * Inputs:
+ *     ctx - The search context
+ *     begin - The first candidate
+ *     end - One past the last candidate
+ */
+static void scoreCandidates(void *ctx, int begin, int end){
+    search_ctx *s = (search_ctx*)ctx;
+    tile_args args;  // Candidate arguments
+    image_f tile;    // Scaled proxy tile
+    image_f dst;     // Unnormalized output
+    image_f acc;     // Accumulated weights
+    int h = (*(*s).proxy).height;
+    int w = (*(*s).proxy).width;
+    int c;           // Iterator
+
+    for (c=begin; c<end; c++){
+        args = (*s).base;
+        candidateArgs(&args,c,h,w,(*s).factor);
+        tileSize(&args.pHeight,&args.pWidth,h,w,args);
+        if (args.pHeight < 2 || args.pWidth < 2 || ((h < w ? h : w) >> args.octave) < 1){
+            (*s).scores[c] = INFINITY;
+            continue;
+        }
+        image_scale(&tile,(*s).proxy,args.pHeight,args.pWidth,SIMPLE);
+        tileAccumulate(&dst,&acc,&tile,1,h,w,args);
+        (*s).scores[c] = scoreTiling(&dst,&acc,(*s).srcGrad);
+        dealloc_image(&tile);
+        dealloc_image(&dst);
+        dealloc_image(&acc);
+    }
+}
+
+/*
+ * This searches a grid of octaves, tile sizes and blurs for
+ * the best scoring tiling of a low resolution proxy of the
+ * source (see scoreTiling) and sets them in the arguments.
+ * Only the parameters flagged in autoTune are searched and
+ * the others are kept as given.  Candidates are evaluated in
+ * parallel.  Images too small (or thin) to search on are
+ * reported instead of aborting, so long running callers can
+ * carry on.
+ *
+ * Inputs:
+ *     args - The shaping arguments (modified)
+ *     src - The input image
+ *     err - The reason the search failed (modified on failure)
+ * Outputs:
+ *     ret - 0 on success, -1 on failure
+ */
+int searchArgs(tile_args *args, image_f *src, const char **err){
+    search_ctx s;      // Search context
+    image_f proxy;     // Low resolution source
+    int factor;        // Proxy shrinking factor
+    int c,best = 0;    // Candidate iterator and winner
+    int n;             // Number of candidates
+    int tH,tW;         // Chosen tile size
+    int h = (*src).height;
+    int w = (*src).width;
+    int m = h < w ? h : w; // Smaller side
+
+    // Create proxy (keeping at least 2 pixels across the smaller side)
+    if (m < 2){
+        *err = "image is too small to search parameters";
+        return -1;
+    }
+    factor = (h > w ? h : w)/PROXY_SIZE;
+    factor = factor < m/2 ? factor : m/2;
+    factor = factor > 1 ? factor : 1;
+    image_shrink(&proxy,src,factor);
+
+    // Score all candidates
+    s.proxy = &proxy;
+    s.base = *args;
+    s.factor = factor;
+    s.srcGrad = meanGradient(&proxy);
+    n = candidateCount((*args).autoTune);
+    s.scores = (float*)malloc(sizeof(float)*n);
+    if (!s.scores){
+        perror_("ERROR: Score allocation failed.");
+    }
+    parallel_for(n,scoreCandidates,&s);
+
+    // Apply the winner at full resolution
+    for (c=1; c<n; c++){
+        if (s.scores[c] < s.scores[best]){
+            best = c;
+        }
+    }
+    if (isinf(s.scores[best])){
+        free(s.scores);
+        dealloc_image(&proxy);
+        *err = "image is too small to search parameters";
+        return -1;
+    }
+    candidateArgs(args,best,h,w,1);
+    tileSize(&tH,&tW,h,w,*args);
+    fprintf(stderr,"auto: octave=%d tile=%dx%d blur=%.2f score=%.3f\n",
+            (*args).octave,tH,tW,(*args).blur,s.scores[best]);
+
+    // Deallocate
+    free(s.scores);
+    dealloc_image(&proxy);
+
+    return 0;
+}
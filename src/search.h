@@ -0,0 +1,19 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * *
+ * Predefinitions for automatic searching of the
+ * tiling shaping parameters.
+ *
+ * Author: Michael Dushkoff (mad1841@rit.edu)
+ * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "image.h"
+#include "tile.h"
+
+// SEARCH_H_
+#ifndef SEARCH_H_
+#define SEARCH_H_
+
+/**** Search operations ****/
+float scoreTiling(image_f *dst, image_f *acc, float srcGrad);
+int searchArgs(tile_args *args, image_f *src, const char **err);
+
+#endif // END SEARCH_H_
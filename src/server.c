@@ -0,0 +1,267 @@
+/*
+ * This implements a resident tiling server which accepts
+ * jobs as lines of "input.png output.png [options]" and
+ * keeps decoded sources and scaled tiles cached between
+ * jobs so that repeated inputs skip decoding and scaling.
+ *
+ * Author: Michael Dushkoff (mad1841@rit.edu)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+#include "job.h"
+#include "tile.h"
+#include "image.h"
+#include "search.h"
+
+/*
+ * This releases the cached images taken by a job.
+ *
+ * Inputs:
+ *     cache - The image cache (modified)
+ *     imgs - The cached images (NULL entries are skipped)
+ *     n - The number of images
+ */
+static void release_all(image_cache *cache, image_f **imgs, int n){
+    int k; // Iterator
+
+    for (k=0; k<n; k++){
+        if (imgs[k]){
+            cache_release(cache,imgs[k]);
+        }
+    }
+}
+
+/*
+ * This runs a single job using cached images wherever
+ * possible and reports the result.  Unreadable inputs and
+ * unwritable outputs are reported as errors without
+ * disturbing the server.
+ *
+ * Inputs:
+ *     job - The job to run
+ *     cache - The image cache (modified)
+ *     out - The stream to report to
+ */
+static void run_job(tile_job *job, image_cache *cache, FILE *out){
+    unsigned long long hash[MAX_MAPS]; // Source content hashes
+    image_f *src[MAX_MAPS] = {NULL};   // Decoded sources
+    image_f *tile[MAX_MAPS] = {NULL};  // Scaled tiles
+    image_f tiles[MAX_MAPS];           // Scaled tiles (contiguous)
+    image_f dst[MAX_MAPS];             // Output images
+    image_f img;                       // Newly created image
+    const char *err = NULL;            // Reason for a failure
+    char *errFile = NULL;              // File that failed
+    int n = (*job).numMaps;            // Number of maps
+    int tH,tW;                         // Tile heights and widths
+    int srcHits = 0,tileHits = 0;      // Cache hit counts
+    int k;                             // Iterator
+
+    // Identify the sources by content (this also validates them)
+    for (k=0; k<n; k++){
+        if (hash_file(&hash[k],(*job).mapIn[k]) != 0){
+            fprintf(out,"error %s: could not read PNG file\n",(*job).mapIn[k]);
+            return;
+        }
+    }
+
+    // Check outputs before doing any work
+    k = check_outputs(job);
+    if (k >= 0){
+        fprintf(out,"error %s: could not open for writing\n",(*job).mapOut[k]);
+        return;
+    }
+
+    // Get decoded sources
+    for (k=0; k<n; k++){
+        src[k] = cache_get(cache,CACHE_SOURCE,hash[k],0,0);
+        srcHits += src[k] != NULL;
+        if (!src[k]){
+            if (load_png(&img,(*job).mapIn[k],&err) != 0){
+                fprintf(out,"error %s: %s\n",(*job).mapIn[k],err);
+                release_all(cache,src,k);
+                return;
+            }
+            src[k] = cache_put(cache,CACHE_SOURCE,hash[k],0,0,img);
+        }
+    }
+
+    // Check that all maps are aligned
+    for (k=1; k<n; k++){
+        if ((*src[k]).height != (*src[0]).height || (*src[k]).width != (*src[0]).width){
+            fprintf(out,"error %s: size does not match %s\n",(*job).mapIn[k],(*job).mapIn[0]);
+            release_all(cache,src,n);
+            return;
+        }
+    }
+
+    // Check that every placement cell is at least one pixel
+    if (check_octave(job,(*src[0]).height,(*src[0]).width) != 0){
+        fprintf(out,"error %s: octave too large for the image size\n",(*job).mapIn[0]);
+        release_all(cache,src,n);
+        return;
+    }
+
+    // Choose shaping arguments automatically
+    if ((*job).args.autoTune && searchArgs(&(*job).args,src[0],&err) != 0){
+        fprintf(out,"error %s: %s\n",(*job).mapIn[0],err);
+        release_all(cache,src,n);
+        return;
+    }
+
+    // Get scaled tiles
+    tileSize(&tH,&tW,(*src[0]).height,(*src[0]).width,(*job).args);
+    for (k=0; k<n; k++){
+        tile[k] = cache_get(cache,CACHE_TILE,hash[k],tH,tW);
+        tileHits += tile[k] != NULL;
+        if (!tile[k]){
+            image_scale(&img,src[k],tH,tW,SIMPLE);
+            tile[k] = cache_put(cache,CACHE_TILE,hash[k],tH,tW,img);
+        }
+        tiles[k] = *tile[k];
+    }
+
+    // Perform tiling operation and write outputs
+    tileImagesPatch(dst,tiles,n,(*job).mapNormal,(*src[0]).height,(*src[0]).width,(*job).args);
+    for (k=0; k<n; k++){
+        if (!err && save_png(&dst[k],(*job).mapOut[k],8,&err) != 0){
+            errFile = (*job).mapOut[k];
+        }
+    }
+
+    // Deallocate
+    for (k=0; k<n; k++){
+        dealloc_image(&dst[k]);
+    }
+    release_all(cache,tile,n);
+    release_all(cache,src,n);
+
+    if (err){
+        fprintf(out,"error %s: %s\n",errFile,err);
+        return;
+    }
+    fprintf(out,"ok %s source=%d/%d tile=%d/%d\n",(*job).outFile,
+            srcHits,n,tileHits,n);
+}
+
+/*
+ * This reports the cache statistics.
+ *
+ * Inputs:
+ *     out - The stream to report to
+ *     cache - The image cache
+ */
+void serve_stats(FILE *out, image_cache *cache){
+    fprintf(out,"stats source=%lu/%lu tile=%lu/%lu hit_rate=%.1f%% "
+                "cached=%luMB evictions=%lu\n",
+            (*cache).hits[CACHE_SOURCE],
+            (*cache).hits[CACHE_SOURCE]+(*cache).misses[CACHE_SOURCE],
+            (*cache).hits[CACHE_TILE],
+            (*cache).hits[CACHE_TILE]+(*cache).misses[CACHE_TILE],
+            100.0*cache_hitRate(cache,CACHE_KINDS),
+            (unsigned long)((*cache).bytes>>20),(*cache).evictions);
+}
+
+/*
+ * This serves jobs from a line based stream until the end
+ * of the stream or a "quit" command.  Besides jobs, the
+ * "stats" command reports the cache hit rates.
+ *
+ * Inputs:
+ *     in - The stream to read commands from
+ *     out - The stream to write replies to
+ *     cache - The image cache (modified)
+ * Outputs:
+ *     ret - 1 if "quit" was requested, 0 otherwise
+ */
+int serve_stream(FILE *in, FILE *out, image_cache *cache){
+    char line[MAX_LINE];      // Current line
+    char *tokens[MAX_TOKENS]; // Tokenized line
+    int n;                    // Number of tokens
+    tile_job job;             // Parsed job
+
+    while (fgets(line,MAX_LINE,in)){
+        // Dispatch command
+        n = tokenize_job(line,tokens,MAX_TOKENS);
+        if (n == 0){
+            continue;
+        }
+        else if (strcmp(tokens[0],"quit") == 0){
+            return 1;
+        }
+        else if (strcmp(tokens[0],"stats") == 0){
+            serve_stats(out,cache);
+        }
+        else if (parse_job(&job,n,tokens) == 0){
+            run_job(&job,cache,out);
+        }
+        else{
+            fprintf(out,"error invalid job\n");
+        }
+        fflush(out);
+    }
+
+    return 0;
+}
+
+/*
+ * This serves jobs over a Unix domain socket, handling one
+ * connection at a time, until a "quit" command is received.
+ *
+ * Inputs:
+ *     path - The socket path
+ *     cache - The image cache (modified)
+ * Outputs:
+ *     ret - 0 on success, -1 if the socket could not be created
+ */
+int serve_socket(char *path, image_cache *cache){
+    struct sockaddr_un addr; // Socket address
+    int sock,conn;           // Socket descriptors
+    int quit = 0;            // Whether "quit" was requested
+    FILE *in,*out;           // Connection streams
+
+    // Replies to closed connections should not end the server
+    signal(SIGPIPE,SIG_IGN);
+
+    // Create and bind socket
+    if (strlen(path) >= sizeof(addr.sun_path)){
+        return -1;
+    }
+    sock = socket(AF_UNIX,SOCK_STREAM,0);
+    if (sock < 0){
+        return -1;
+    }
+    memset(&addr,0,sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path,path);
+    unlink(path);
+    if (bind(sock,(struct sockaddr*)&addr,sizeof(addr)) < 0 || listen(sock,8) < 0){
+        close(sock);
+        return -1;
+    }
+
+    // Serve connections
+    while (!quit){
+        conn = accept(sock,NULL,NULL);
+        if (conn < 0){
+            continue;
+        }
+        in = fdopen(conn,"r");
+        out = fdopen(dup(conn),"w");
+        quit = serve_stream(in,out,cache);
+        fclose(in);
+        fclose(out);
+    }
+
+    // Clean up socket
+    close(sock);
+    unlink(path);
+
+    return 0;
+}
@@ -0,0 +1,19 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * *
+ * Predefinitions for the resident tiling server.
+ *
+ * Author: Michael Dushkoff (mad1841@rit.edu)
+ * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include "cache.h"
+
+// SERVER_H_
+#ifndef SERVER_H_
+#define SERVER_H_
+
+/**** Server operations ****/
+int serve_stream(FILE *in, FILE *out, image_cache *cache);
+int serve_socket(char *path, image_cache *cache);
+void serve_stats(FILE *out, image_cache *cache);
+
+#endif // END SERVER_H_
@@ -0,0 +1,136 @@
+/*
+ * This provides basic threading helpers for splitting
+ * loops across all available cores.
+ *
+ * Author: Michael Dushkoff (mad1841@rit.edu)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "thread.h"
+#include "image.h"
+
+// Definitions
+#define CHUNKS_PER_THREAD (4)
+
+// Whether parallel loops started from this thread run serially
+static __thread int serialLoops = 0;
+
+/**** Structure declarations ****/
+typedef struct{
+    range_fn fn;
+    void *ctx;
+    int n;
+    int chunk;
+    int next;             // Next unclaimed index
+    pthread_mutex_t lock;
+} range_job;
+
+/*
+ * This gets the number of threads to use for parallel loops.
+ *
+ * Outputs:
+ *     n - The number of online cores (at least 1)
+ */
+int num_threads(){
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return cores > 0 ? (int)cores : 1;
+}
+
+/*
+ * This sets whether parallel loops started from the calling
+ * thread run serially, which avoids oversubscribing the cores
+ * from threads that are already one of several workers.
+ *
+ * Inputs:
+ *     serial - Whether to run parallel loops serially
+ */
+void serial_loops(int serial){
+    serialLoops = serial;
+}
+
+/*
+ * This is the body of every loop thread, which repeatedly
+ * claims and runs chunks of the range.
+ *
+ * Inputs:
+ *     arg - The range job
+ */
+static void *range_worker(void *arg){
+    range_job *job = (range_job*)arg;
+    int begin,end; // Claimed chunk
+
+    while (1){
+        pthread_mutex_lock(&(*job).lock);
+        begin = (*job).next;
+        end = begin+(*job).chunk < (*job).n ? begin+(*job).chunk : (*job).n;
+        (*job).next = end;
+        pthread_mutex_unlock(&(*job).lock);
+
+        if (begin >= end){
+            break;
+        }
+        (*job).fn((*job).ctx,begin,end);
+    }
+
+    return NULL;
+}
+
+/*
+ * This runs a function over the range [0,n) split into chunks
+ * which are claimed dynamically by one thread per core, so
+ * uneven work per index is still balanced.  The calling
+ * thread takes part and the call returns once every index
+ * has been processed.  Loops run directly on the calling
+ * thread if it is marked serial (see serial_loops).
+ *
+ * Inputs:
+ *     n - The size of the range
+ *     fn - The function to run on each chunk [begin,end)
+ *     ctx - The context passed to the function
+ */
+void parallel_for(int n, range_fn fn, void *ctx){
+    range_job job;       // Shared range state
+    pthread_t *workers;  // Helper threads
+    int t;               // Number of threads
+    int i;               // Iterator
+
+    // Run small ranges directly
+    t = serialLoops ? 1 : (num_threads() < n ? num_threads() : n);
+    if (t <= 1){
+        if (n > 0){
+            fn(ctx,0,n);
+        }
+        return;
+    }
+
+    // Set up shared range
+    job.fn = fn;
+    job.ctx = ctx;
+    job.n = n;
+    job.chunk = (n+t*CHUNKS_PER_THREAD-1)/(t*CHUNKS_PER_THREAD);
+    job.next = 0;
+    pthread_mutex_init(&job.lock,NULL);
+
+    // Start helper threads and work alongside them
+    workers = (pthread_t*)malloc(sizeof(pthread_t)*(t-1));
+    if (!workers){
+        perror_("ERROR: Thread allocation failed.");
+    }
+    for (i=0; i<t-1; i++){
+        if (pthread_create(&workers[i],NULL,range_worker,&job) != 0){
+            perror_("ERROR: Thread creation failed.");
+        }
+    }
+    range_worker(&job);
+    for (i=0; i<t-1; i++){
+        pthread_join(workers[i],NULL);
+    }
+
+    // Deallocate
+    free(workers);
+    pthread_mutex_destroy(&job.lock);
+}
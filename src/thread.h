@@ -0,0 +1,19 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * *
+ * Predefinitions of basic threading helpers.
+ *
+ * Author: Michael Dushkoff (mad1841@rit.edu)
+ * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// THREAD_H_
+#ifndef THREAD_H_
+#define THREAD_H_
+
+/**** Range function type ****/
+typedef void (*range_fn)(void *ctx, int begin, int end);
+
+/**** Threading operations ****/
+int num_threads();
+void serial_loops(int serial);
+void parallel_for(int n, range_fn fn, void *ctx);
+
+#endif // END THREAD_H_
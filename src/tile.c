@@ -6,14 +6,86 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include "tile.h"
 #include "image.h"
+#include "search.h"
+#include "pyramid.h"
+#include "poisson.h"
+
+// Definitions
+#define BLOCK_BYTES (256*1024) // Output block working set (fits in L2)
+#define BLOCK_MAX_W (512)      // Maximum output block width
 
 // Modulus & wrapping macro definitions
 #define mod(x,y) (x%y<0?x%y+x:x%y)
 #define wrp(x,y) (x%y>=0?x%y:y+x%y)
 
+/**** Span kernel type ****/
+typedef void (*span_kernel)(float *out, float *acc, float *in, float *m,
+                            int len, int outPlane, int inPlane);
+
+/*
+ * This defines a kernel which accumulates one row of a span
+ * for a single map of a fixed depth.  The depth is a compile
+ * time constant so that the plane loop is fully unrolled and
+ * every plane is accumulated in the same pass over the row.
+ *
+ * Inputs:
+ *     out - The first plane of the output row (modified)
+ *     acc - The accumulator row (modified)
+ *     in - The first plane of the tile row
+ *     m - The mask row
+ *     len - The row length
+ *     outPlane - The output plane size
+ *     inPlane - The tile plane size
+ */
+#define DEFINE_SPAN_KERNEL(NAME,D)                                          \
+static void NAME(float *out, float *acc, float *in, float *m,               \
+                 int len, int outPlane, int inPlane){                       \
+    int x,z;  /* Iterators */                                               \
+    float mv; /* Mask weight */                                             \
+                                                                            \
+    for (x=0; x<len; x++){                                                  \
+        mv = m[x];                                                          \
+        acc[x] += mv;                                                       \
+        for (z=0; z<(D); z++){                                              \
+            out[z*outPlane+x] += in[z*inPlane+x]*mv;                        \
+        }                                                                   \
+    }                                                                       \
+}
+
+// Specialized kernels (grey, RGB and RGBA)
+DEFINE_SPAN_KERNEL(spanKernel1,1)
+DEFINE_SPAN_KERNEL(spanKernel3,3)
+DEFINE_SPAN_KERNEL(spanKernel4,4)
+
+/*
+ * This selects a specialized span kernel for the given maps.
+ *
+ * Inputs:
+ *     tiles - The scaled tiles
+ *     n - The number of tiles
+ * Outputs:
+ *     kernel - The kernel or NULL if only the generic path applies
+ */
+static span_kernel selectKernel(image_f *tiles, int n){
+    if (n != 1){
+        return NULL;
+    }
+    switch (tiles[0].depth){
+        case 1:
+            return spanKernel1;
+        case 3:
+            return spanKernel3;
+        case 4:
+            return spanKernel4;
+        default:
+            return NULL;
+    }
+}
+
 /*
  * This sets the arguments of a given
  * argument structure to their defaults.
@@ -30,6 +102,38 @@ void setDefaultArgs(tile_args *args){
     (*args).rotBase = 0.0; (*args).rotVar = 0.0;
     (*args).scaleBase = 1.0; (*args).scaleVar = 0.0;
     (*args).seed = 0; // Implies always random
+    (*args).autoTune = 0;
+    (*args).blend = BLEND_AVERAGE;
+    (*args).levels = 0; // Implies automatic
+}
+
+/*
+ * This calculates the tile (patch) size used for a given
+ * output size, falling back to an adaptive size of one
+ * octave cell when no explicit size is given.
+ *
+ * Inputs:
+ *     tH - The tile height (modified)
+ *     tW - The tile width (modified)
+ *     height - The output image height
+ *     width - The output image width
+ *     args - Shaping arguments (see tileImage)
+ */
+void tileSize(int *tH, int *tW, int height, int width, tile_args args){
+    int v = pow(2,args.octave); // Octave square root boundary
+
+    if (args.pHeight > 0){
+        *tH = args.pHeight;
+    }
+    else{
+        *tH = (height+v-1)/v;
+    }
+    if (args.pWidth > 0){
+        *tW = args.pWidth;
+    }
+    else{
+        *tW = (width+v-1)/v;
+    }
 }
 
 /*
@@ -49,85 +153,466 @@ void setDefaultArgs(tile_args *args){
  *         scaleBase - Base image scale
  *         scaleVar - Scale variance
  *         seed - Seed
+ *         autoTune - Parameters to search for (see searchArgs)
+ *         blend - Blending method
+ *         levels - Pyramid levels (see pyramidBlend)
  */
 void tileImage(image_f *dst, image_f *src, tile_args args){
-    image_f tile;  // Scaled tile
-    image_f mask;  // Gaussian mask
-    image_f acc;   // Accumulator for normalization
-    int tH,tW;     // Corrected tile heights and widths
-    int h,w,d,v;   // Boundaries
-    int o,x,y,z;   // Iterators
-    int i;         // Exact coordinate (for reuse)
-    int xoff,yoff; // Coordinate offsets (per tile)
+    tileImages(dst,src,1,NULL,args);
+}
 
-    // Save boundaries for easy access
-    h = (*src).height; w = (*src).width; d = (*src).depth;
-    v = pow(2,args.octave); // Octave square root boundary
+/*
+ * This creates tiled output images for a set of aligned input
+ * images (e.g. the albedo, normal and roughness maps of one
+ * material) which all receive identical placements.  Any
+ * automatic parameter search is performed on the first image.
+ *
+ * Inputs:
+ *     dsts - The output tiled images (modified)
+ *     srcs - The input images (all of the same height and width)
+ *     n - The number of images
+ *     normals - Flags marking normal maps (or NULL for none)
+ *     args - Shaping arguments (see tileImage)
+ */
+void tileImages(image_f *dsts, image_f *srcs, int n, int *normals, tile_args args){
+    image_f *tiles; // Scaled tiles
+    int tH,tW;      // Corrected tile heights and widths
+    const char *err; // Search failure
+    int k;          // Iterator
 
-    // Create destination image (with initial background)
-    alloc_image(dst,h,w,d);
-    image_fillChan(&(*dst),args.bgColor.r,0);
-    image_fillChan(&(*dst),args.bgColor.g,1);
-    image_fillChan(&(*dst),args.bgColor.b,2);
-    //image_fillChan(&(*dst),0.0,3);
+    // Choose shaping arguments automatically
+    if (args.autoTune && searchArgs(&args,&srcs[0],&err) != 0){
+        perror_("ERROR: Image is too small to search parameters.");
+    }
 
-    // Create tile (scaled source)
-    if (args.pHeight > 0){
-        tH  = args.pHeight;
+    // Create tiles (scaled sources)
+    tiles = (image_f*)malloc(sizeof(image_f)*n);
+    if (!tiles){
+        perror_("ERROR: Tile allocation failed.");
     }
-    else{
-        tH = h/v;
+    tileSize(&tH,&tW,srcs[0].height,srcs[0].width,args);
+    for (k=0; k<n; k++){
+        if (srcs[k].height != srcs[0].height || srcs[k].width != srcs[0].width){
+            perror_("ERROR: Image sizes do not match.");
+        }
+        image_scale(&tiles[k],&srcs[k],tH,tW,SIMPLE);
     }
-    if (args.pWidth >0){
-        tW = args.pWidth;
+
+    // Perform tiling operation
+    tileImagesPatch(dsts,tiles,n,normals,srcs[0].height,srcs[0].width,args);
+
+    // Deallocate
+    for (k=0; k<n; k++){
+        dealloc_image(&tiles[k]);
     }
-    else{
-        tW = w/v;
+    free(tiles);
+}
+
+/*
+ * This creates a tiled output image from an already scaled
+ * tile.  The tile is left unmodified so that it may be
+ * reused (e.g. from a cache) across multiple calls.
+ *
+ * Inputs:
+ *     dst - The output tiled image (modified)
+ *     tile - The scaled tile (see tileSize)
+ *     height - The output image height
+ *     width - The output image width
+ *     args - Shaping arguments (see tileImage)
+ */
+void tileImagePatch(image_f *dst, image_f *tile, int height, int width, tile_args args){
+    tileImagesPatch(dst,tile,1,NULL,height,width,args);
+}
+
+/*
+ * This creates tiled output images from a set of already
+ * scaled, aligned tiles (see tileImages).
+ *
+ * Inputs:
+ *     dsts - The output tiled images (modified)
+ *     tiles - The scaled tiles (see tileSize)
+ *     n - The number of tiles
+ *     normals - Flags marking normal maps (or NULL for none)
+ *     height - The output image height
+ *     width - The output image width
+ *     args - Shaping arguments (see tileImage)
+ */
+void tileImagesPatch(image_f *dsts, image_f *tiles, int n, int *normals, int height, int width, tile_args args){
+    image_f acc; // Shared accumulator for normalization
+
+    // Check for multi-band or gradient-domain blending
+    if (args.blend == BLEND_PYRAMID){
+        pyramidBlend(dsts,tiles,n,normals,height,width,args);
+        return;
+    }
+    if (args.blend == BLEND_POISSON){
+        poissonBlend(dsts,tiles,n,normals,height,width,args);
+        return;
     }
-    image_scale(&tile,src,tH,tW,SIMPLE);
 
-    // Create mask
-    alloc_image(&mask,tH,tW,d);
-    image_gaussmat(&mask,args.blur,1.0);
+    // Accumulate all masked placements
+    tileAccumulate(dsts,&acc,tiles,n,height,width,args);
 
-    // Create accumulator
-    alloc_image(&acc,h,w,d);
-    image_fill(&acc,0.0);
+    // Divide output images by accumulator
+    tileNormalize(dsts,&acc,n,normals);
 
-    // Mask the tile
-    image_mul(&tile,&mask);
+    // Deallocate
+    dealloc_image(&acc);
+}
 
-    // Perform tiling operation
+/*
+ * This creates the placement plan shared by every map of a
+ * tiling operation: the placement offsets and a single plane
+ * Gaussian mask.
+ *
+ * Inputs:
+ *     plan - The placement plan (modified)
+ *     tH - The tile height
+ *     tW - The tile width
+ *     height - The output image height
+ *     width - The output image width
+ *     args - Shaping arguments (see tileImage)
+ */
+void tilePlan(tile_plan *plan, int tH, int tW, int height, int width, tile_args args){
+    int h,w,v; // Boundaries
+    int o;     // Iterator
+
+    // Save boundaries for easy access
+    h = height; w = width;
+    v = pow(2,args.octave); // Octave square root boundary
+
+    (*plan).height = h;
+    (*plan).width = w;
+    (*plan).count = v*v;
+    (*plan).xoff = (int*)malloc(sizeof(int)*v*v);
+    (*plan).yoff = (int*)malloc(sizeof(int)*v*v);
+    if (!(*plan).xoff || !(*plan).yoff){
+        perror_("ERROR: Placement allocation failed.");
+    }
+
+    // Calculate coordinate offsets (cell centers are spread over
+    // the whole output so sizes which do not divide evenly leave
+    // no uncovered rows or columns)
     for (o=0; o<(v*v); o++){ // Octave iteration
-        // Calculate coordinate offsets
-        xoff = (w/v)*(o%v)-(tW/2)+(w/(v*2));
-        yoff = (h/v)*(o/v)-(tH/2)+(h/(v*2));
+        (*plan).xoff[o] = (int)(((long)w*(2*(o%v)+1))/(2*v))-(tW/2);
+        (*plan).yoff[o] = (int)(((long)h*(2*(o/v)+1))/(2*v))-(tH/2);
 
         // TODO: Calculate random rotation/scale
+    }
 
-        // Loop through all tile pixels and place them
-        for (y=0; y<tH; y++){
-            for (x=0; x<tW; x++){
-                for (z=0; z<d; z++){
-                    // Calculate output coordinates
-                    i = (z*h*w+wrp((y+yoff),h)*w+wrp((x+xoff),w));
+    // Create mask
+    alloc_image(&(*plan).mask,tH,tW,1);
+    image_gaussmat(&(*plan).mask,args.blur,1.0);
 
-                    // Accumulate image
-                    (*dst).data[i] += tile.data[z*tH*tW+y*tW+x];
+    // No schedule until requested
+    (*plan).blocks = 0;
+    (*plan).first = NULL;
+    (*plan).spans = NULL;
+}
+
+/*
+ * This splits a wrapped placement range into segments which
+ * do not wrap.  There are at most len/size+2 segments.
+ *
+ * Inputs:
+ *     seg - Segments as (tile start, output start, length) (modified)
+ *     off - The placement offset
+ *     len - The tile length
+ *     size - The output length
+ * Outputs:
+ *     n - The number of segments
+ */
+int tileSegments(int *seg, int off, int len, int size){
+    int t = 0; // Tile coordinate
+    int n = 0; // Number of segments
+    int p;     // Output coordinate
+
+    while (t < len){
+        p = wrp((t+off),size);
+        seg[3*n] = t;
+        seg[3*n+1] = p;
+        seg[3*n+2] = len-t < size-p ? len-t : size-p;
+        t += seg[3*n+2];
+        n++;
+    }
+    return n;
+}
+
+/*
+ * This precomputes a cache blocked schedule for a placement
+ * plan.  The output is split into blocks whose working set
+ * (every accumulated plane) fits in cache and each block lists
+ * the non-wrapping spans of every placement overlapping it, in
+ * placement order.  Applying all spans of one block before
+ * moving on to the next brings each output pixel into cache
+ * once instead of once per overlapping placement, while the
+ * order of accumulation per pixel is unchanged.
+ *
+ * Inputs:
+ *     plan - The placement plan (modified)
+ *     planes - The number of accumulated planes per pixel
+ */
+void planSchedule(tile_plan *plan, int planes){
+    int h,w,tH,tW;    // Boundaries
+    int bH,bW;        // Block sizes
+    int bRows,bCols;  // Number of block rows and columns
+    int *ySeg,*xSeg;  // Non-wrapping segments
+    int ny,nx;        // Number of segments
+    int *next;        // Fill position per block
+    int pass,o,a,b;   // Iterators
+    int by,bx;        // Block iterators
+    int y0,y1,x0,x1;  // Span bounds
+    int s;            // Span index
+    tile_span *span;  // Current span
+
+    // Save boundaries for easy access
+    h = (*plan).height; w = (*plan).width;
+    tH = (*plan).mask.height; tW = (*plan).mask.width;
+
+    // Choose wide blocks whose working set fits in cache
+    planes = planes > 0 ? planes : 1;
+    bW = w < BLOCK_MAX_W ? w : BLOCK_MAX_W;
+    bH = BLOCK_BYTES/(sizeof(float)*planes*bW);
+    bH = bH < 1 ? 1 : (bH > h ? h : bH);
+    bRows = (h+bH-1)/bH;
+    bCols = (w+bW-1)/bW;
+    (*plan).blockH = bH;
+    (*plan).blockW = bW;
+    (*plan).blocks = bRows*bCols;
 
-                    // Accumulate divisor
-                    acc.data[i] += mask.data[z*tH*tW+y*tW+x];
+    // Allocate schedule
+    ySeg = (int*)malloc(sizeof(int)*3*(tH/h+2));
+    xSeg = (int*)malloc(sizeof(int)*3*(tW/w+2));
+    next = (int*)malloc(sizeof(int)*(*plan).blocks);
+    (*plan).first = (int*)calloc((*plan).blocks+1,sizeof(int));
+    if (!ySeg || !xSeg || !next || !(*plan).first){
+        perror_("ERROR: Schedule allocation failed.");
+    }
+
+    // Count spans per block and then fill them in
+    for (pass=0; pass<2; pass++){
+        if (pass == 1){
+            for (b=0; b<(*plan).blocks; b++){
+                (*plan).first[b+1] += (*plan).first[b];
+                next[b] = (*plan).first[b];
+            }
+            (*plan).spans = (tile_span*)malloc(sizeof(tile_span)*(*plan).first[(*plan).blocks]);
+            if (!(*plan).spans && (*plan).first[(*plan).blocks] > 0){
+                perror_("ERROR: Schedule allocation failed.");
+            }
+        }
+        for (o=0; o<(*plan).count; o++){
+            ny = tileSegments(ySeg,(*plan).yoff[o],tH,h);
+            nx = tileSegments(xSeg,(*plan).xoff[o],tW,w);
+            for (a=0; a<ny; a++){
+                for (by=ySeg[3*a+1]/bH; by*bH < ySeg[3*a+1]+ySeg[3*a+2]; by++){
+                    y0 = by*bH > ySeg[3*a+1] ? by*bH : ySeg[3*a+1];
+                    y1 = (by+1)*bH < ySeg[3*a+1]+ySeg[3*a+2] ? (by+1)*bH : ySeg[3*a+1]+ySeg[3*a+2];
+                    for (b=0; b<nx; b++){
+                        for (bx=xSeg[3*b+1]/bW; bx*bW < xSeg[3*b+1]+xSeg[3*b+2]; bx++){
+                            if (pass == 0){
+                                (*plan).first[by*bCols+bx+1]++;
+                                continue;
+                            }
+                            x0 = bx*bW > xSeg[3*b+1] ? bx*bW : xSeg[3*b+1];
+                            x1 = (bx+1)*bW < xSeg[3*b+1]+xSeg[3*b+2] ? (bx+1)*bW : xSeg[3*b+1]+xSeg[3*b+2];
+                            s = next[by*bCols+bx]++;
+                            span = &(*plan).spans[s];
+                            (*span).y = y0;
+                            (*span).x = x0;
+                            (*span).ty = ySeg[3*a]+(y0-ySeg[3*a+1]);
+                            (*span).tx = xSeg[3*b]+(x0-xSeg[3*b+1]);
+                            (*span).height = y1-y0;
+                            (*span).width = x1-x0;
+                        }
+                    }
                 }
             }
         }
     }
 
-    // Divide output image by accumulator
-    image_div(dst,&acc);
+    // Deallocate
+    free(ySeg);
+    free(xSeg);
+    free(next);
+}
+
+/*
+ * This deallocates a placement plan.
+ *
+ * Inputs:
+ *     plan - The placement plan
+ */
+void freePlan(tile_plan *plan){
+    free((*plan).xoff);
+    free((*plan).yoff);
+    free((*plan).first);
+    free((*plan).spans);
+    dealloc_image(&(*plan).mask);
+}
+
+/*
+ * This accumulates every masked placement of a set of aligned
+ * tiles into unnormalized output images along with the single
+ * plane of accumulated mask weights used to normalize them.
+ * All maps are accumulated in the same pass over the output,
+ * one cache sized output block at a time (see planSchedule).
+ *
+ * Inputs:
+ *     dsts - The unnormalized output images (modified)
+ *     acc - The accumulated mask weights (modified)
+ *     tiles - The scaled tiles (see tileSize)
+ *     n - The number of tiles
+ *     height - The output image height
+ *     width - The output image width
+ *     args - Shaping arguments (see tileImage)
+ */
+void tileAccumulate(image_f *dsts, image_f *acc, image_f *tiles, int n, int height, int width, tile_args args){
+    tile_plan plan;     // Placement plan
+    tile_span *span;    // Current span
+    span_kernel kernel; // Specialized kernel (NULL for generic)
+    int tH,tW;          // Tile heights and widths
+    int h,w,d;          // Boundaries
+    int planes = 1;     // Accumulated planes per pixel
+    int b,s,x,y,z,k;    // Iterators
+    int i,j;            // Row coordinates (for reuse)
+    float *m;           // Mask row
+    float *out,*in;     // Output and tile rows
+
+    // Save boundaries for easy access
+    h = height; w = width;
+    tH = tiles[0].height; tW = tiles[0].width;
+
+    // Create destination images (with initial background)
+    for (k=0; k<n; k++){
+        if (tiles[k].height != tH || tiles[k].width != tW){
+            perror_("ERROR: Image sizes do not match.");
+        }
+        d = tiles[k].depth;
+        planes += d;
+        alloc_image(&dsts[k],h,w,d);
+        image_fill(&dsts[k],0.0);
+        if (d > 2){
+            image_fillChan(&dsts[k],args.bgColor.r,0);
+            image_fillChan(&dsts[k],args.bgColor.g,1);
+            image_fillChan(&dsts[k],args.bgColor.b,2);
+        }
+    }
+
+    // Create placement plan and schedule
+    tilePlan(&plan,tH,tW,h,w,args);
+    planSchedule(&plan,planes);
+
+    // Create accumulator
+    alloc_image(acc,h,w,1);
+    image_fill(acc,0.0);
+
+    // Perform tiling operation block by block
+    kernel = selectKernel(tiles,n);
+    for (b=0; b<plan.blocks; b++){
+        for (s=plan.first[b]; s<plan.first[b+1]; s++){
+            span = &plan.spans[s];
+            for (y=0; y<(*span).height; y++){
+                // Calculate output and tile row coordinates
+                i = ((*span).y+y)*w+(*span).x;
+                j = ((*span).ty+y)*tW+(*span).tx;
+                m = &plan.mask.data[j];
+
+                // Accumulate with a specialized kernel when possible
+                if (kernel){
+                    kernel(&dsts[0].data[i],&(*acc).data[i],&tiles[0].data[j],m,
+                           (*span).width,h*w,tH*tW);
+                    continue;
+                }
+
+                // Accumulate divisor
+                out = &(*acc).data[i];
+                for (x=0; x<(*span).width; x++){
+                    out[x] += m[x];
+                }
+
+                // Accumulate masked images
+                for (k=0; k<n; k++){
+                    for (z=0; z<tiles[k].depth; z++){
+                        out = &dsts[k].data[z*h*w+i];
+                        in = &tiles[k].data[z*tH*tW+j];
+                        for (x=0; x<(*span).width; x++){
+                            out[x] += in[x]*m[x];
+                        }
+                    }
+                }
+            }
+        }
+    }
 
     // Deallocate
-    dealloc_image(&tile);
-    //tile = NULL;
-    dealloc_image(&mask);
-    //mask = NULL;
+    freePlan(&plan);
+}
+
+/*
+ * This normalizes accumulated output images by the shared
+ * accumulated weights.  Normal maps are renormalized to unit
+ * length afterwards since an average of unit vectors is not
+ * itself a unit vector.
+ *
+ * Inputs:
+ *     dsts - The unnormalized output images (modified)
+ *     acc - The accumulated mask weights
+ *     n - The number of images
+ *     normals - Flags marking normal maps (or NULL for none)
+ */
+void tileNormalize(image_f *dsts, image_f *acc, int n, int *normals){
+    int p,z,k;    // Iterators
+    int hw;       // Plane size
+    float *data;  // Current output data
+
+    hw = (*acc).height*(*acc).width;
+    for (k=0; k<n; k++){
+        data = dsts[k].data;
+
+        // Divide every plane by the accumulator (pixels which
+        // no placement covers keep their background)
+        for (z=0; z<dsts[k].depth; z++){
+            for (p=0; p<hw; p++){
+                if ((*acc).data[p] > 0){
+                    data[z*hw+p] = data[z*hw+p]/(*acc).data[p];
+                }
+            }
+        }
+
+        // Renormalize normal vectors
+        if (normals && normals[k]){
+            tileRenormalize(&dsts[k]);
+        }
+    }
+}
+
+/*
+ * This renormalizes a normal map (stored as [0,1] per
+ * component) to unit length normals.
+ *
+ * Inputs:
+ *     img - The normal map (modified)
+ */
+void tileRenormalize(image_f *img){
+    int p;              // Iterator
+    int hw;             // Plane size
+    float nx,ny,nz,len; // Normal vector and its length
+    float *data = (*img).data;
+
+    if ((*img).depth < 3){
+        return;
+    }
+    hw = (*img).height*(*img).width;
+    for (p=0; p<hw; p++){
+        nx = 2.0*data[p]-1.0;
+        ny = 2.0*data[hw+p]-1.0;
+        nz = 2.0*data[2*hw+p]-1.0;
+        len = sqrt(nx*nx+ny*ny+nz*nz);
+        if (len > 0){
+            data[p] = 0.5*nx/len+0.5;
+            data[hw+p] = 0.5*ny/len+0.5;
+            data[2*hw+p] = 0.5*nz/len+0.5;
+        }
+    }
 }
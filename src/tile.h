@@ -11,6 +11,19 @@
 #ifndef TILE_H_
 #define TILE_H_
 
+/**** Blending method enumeration ****/
+typedef enum{
+    BLEND_AVERAGE,
+    BLEND_PYRAMID,
+    BLEND_POISSON
+} blend_m;
+
+/**** Searched parameter flags (see searchArgs) ****/
+#define SEARCH_OCTAVE (1)
+#define SEARCH_SIZE (2)
+#define SEARCH_BLUR (4)
+#define SEARCH_ALL (SEARCH_OCTAVE|SEARCH_SIZE|SEARCH_BLUR)
+
 /**** Structure declarations ****/
 typedef struct{
     rgb_f bgColor;
@@ -23,12 +36,53 @@ typedef struct{
     float scaleBase;
     float scaleVar;
     int seed;
+    int autoTune;
+    blend_m blend;
+    int levels;
 } tile_args;
 
+typedef struct{
+    int y;        // Output coordinates
+    int x;
+    int ty;       // Tile coordinates
+    int tx;
+    int height;   // Span size (never wraps)
+    int width;
+} tile_span;
+
+typedef struct{
+    int height;   // Output height
+    int width;    // Output width
+    int count;    // Number of placements
+    int *xoff;    // Placement offsets
+    int *yoff;
+    image_f mask; // Single plane Gaussian mask
+
+    // Cache blocked schedule (see planSchedule)
+    int blockH;   // Output block size
+    int blockW;
+    int blocks;   // Number of output blocks
+    int *first;   // First span of each block (blocks+1 entries)
+    tile_span *spans;
+} tile_plan;
+
 /**** Basic functions ****/
 void setDefaultArgs(tile_args *args);
 
 /**** Full tiling operations ****/
+void tileSize(int *tH, int *tW, int height, int width, tile_args args);
 void tileImage(image_f *dst, image_f *src, tile_args args);
+void tileImages(image_f *dsts, image_f *srcs, int n, int *normals, tile_args args);
+void tileImagePatch(image_f *dst, image_f *tile, int height, int width, tile_args args);
+void tileImagesPatch(image_f *dsts, image_f *tiles, int n, int *normals, int height, int width, tile_args args);
+
+/**** Tiling stages ****/
+void tilePlan(tile_plan *plan, int tH, int tW, int height, int width, tile_args args);
+int tileSegments(int *seg, int off, int len, int size);
+void planSchedule(tile_plan *plan, int planes);
+void freePlan(tile_plan *plan);
+void tileAccumulate(image_f *dsts, image_f *acc, image_f *tiles, int n, int height, int width, tile_args args);
+void tileNormalize(image_f *dsts, image_f *acc, int n, int *normals);
+void tileRenormalize(image_f *img);
 
 #endif // END TILE_H_
@@ -10,180 +10,166 @@
 #include <string.h>
 #include "image.h"
 #include "tile.h"
+#include "job.h"
+#include "cache.h"
+#include "server.h"
+#include "pipeline.h"
 
 // Definitions
-#define NUM_FLAGS (12)
-
-// Basic enumeration of flags
-typedef enum{
-    NONE,
-    COLOR,
-    OCTAVE,
-    HEIGHT,
-    WIDTH,
-    BLUR,
-    ROTATION,
-    ROTVAR,
-    SCALE,
-    SCALEVAR,
-    SEED,
-    HELP
-} FlagType;
-
-// Corresponding flag definitions
-const char *flagDefs[] = {"","-c","-o","-h","-w","-m","-R","-r","-S","-s","-x","--help"};
+#define DEFAULT_CACHE_MB (512)
 
 /*
- * Print the program usage to the user.
- */
-void usage(){
-    printf("Usage:\n");
-    printf("    tilemaker input.png output.png [options]\n");
-    printf("Options:\n");
-    printf("  -c [R,G,B]   Background color\n");
-    printf("  -o           Octave\n");
-    printf("  -h           Patch Height\n");
-    printf("  -w           Patch Width\n");
-    printf("  -m           Mask Blur\n");
-    printf("  -R           Base Rotation (radians)\n");
-    printf("  -r           Rotation Variance\n");
-    printf("  -S           Base Scale Multiplier\n");
-    printf("  -s           Scale Variance\n");
-    printf("  -x           Seed\n");
-    printf("  --help       Show usage information\n");
-}
-
-/*
- * Check a given string to determine if it is a flag.
+ * This runs the resident server with the given server
+ * options.
  *
  * Inputs:
- *     str - The string to check
- * Outputs:
- *     flag - An enumeration of the flag type
+ *     argc - The number of server options
+ *     argv - The server options
  */
-FlagType check_flag(char *str){
-    int i;
+int serve(int argc, char *argv[]){
+    int i;                           // Iterator
+    long cacheMB = DEFAULT_CACHE_MB; // Cache size
+    char *socketPath = NULL;         // Socket path (NULL implies stdin)
+    image_cache cache;               // Image cache
+    int ret = 0;                     // Return value
+
+    // Parse server options
+    for (i=0; i<argc; i++){
+        if (strcmp(argv[i],"-k") == 0 && i+1 < argc){
+            cacheMB = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i],"-u") == 0 && i+1 < argc){
+            socketPath = argv[++i];
+        }
+        else{
+            usage();
+            return -1;
+        }
+    }
 
-    // Loop through all flag types
-    for (i=1; i<NUM_FLAGS; i++){
-        if (strcmp(str,flagDefs[i]) == 0){
-            return i;
+    // Serve jobs
+    cache_init(&cache,(size_t)cacheMB<<20);
+    if (socketPath){
+        if (serve_socket(socketPath,&cache) != 0){
+            fprintf(stderr,"ERROR: Could not listen on %s.\n",socketPath);
+            ret = -1;
         }
     }
-    return 0;
+    else{
+        serve_stream(stdin,stdout,&cache);
+    }
+
+    // Report final cache statistics
+    serve_stats(stderr,&cache);
+    cache_destroy(&cache);
+
+    return ret;
 }
 
 /*
- * Parse given arguments and corresponding flag.
+ * This runs a batch of jobs through the overlapped decode,
+ * tile and encode pipeline with the given batch options.
  *
  * Inputs:
- *     args - The argument pointer (modified)
- *     str - The string value to parse
- *     flag - The given FlagType to apply
+ *     argc - The number of batch options
+ *     argv - The batch options
  */
-void parseArgs(tile_args *args, char *str, FlagType flag){
-    switch(flag){
-        case COLOR:
-            // TODO: Parse color information
-            //(*args).bgColor.r = 
-            //(*args).bgColor.g = 
-            //(*args).bgColor.b = 
-            break;
-        case OCTAVE:
-            (*args).octave = atoi(str);
-            //printf("Octave: %d\n",(*args).octave);
-            break;
-        case HEIGHT:
-            (*args).pHeight = atoi(str);
-            //printf("Height: %d\n",(*args).pHeight);
-            break;
-        case WIDTH:
-            (*args).pWidth = atoi(str);
-            //printf("Width: %d\n",(*args).pWidth);
-            break;
-        case BLUR:
-            (*args).blur = atof(str);
-            //printf("Blur: %f\n",(*args).blur);
-            break;
-        case ROTATION:
-            (*args).rotBase = atof(str);
-            //printf("Rotation: %f\n",(*args).rotBase);
-            break;
-        case ROTVAR:
-            (*args).rotVar = atof(str);
-            //printf("Rotation Variance: %f\n",(*args).rotVar);
-            break;
-        case SCALE:
-            (*args).scaleBase = atof(str);
-            //printf("Scale: %f\n",(*args).scaleBase);
-            break;
-        case SCALEVAR:
-            (*args).scaleVar = atof(str);
-            //printf("Scale Variance: %f\n",(*args).scaleVar);
-            break;
-        case SEED:
-            (*args).seed = atoi(str);
-            //printf("SEED: %d\n",(*args).seed);
-            break;
-        default:
-            break;
+int batch(int argc, char *argv[]){
+    int i;                // Iterator
+    pipe_args args;       // Pipeline arguments
+    FILE *in = stdin;     // Job list (Default=stdin)
+    char *jobFile = NULL; // Job list filename
+    int failed;           // Number of invalid jobs
+
+    // Parse batch options
+    setDefaultPipeArgs(&args);
+    for (i=0; i<argc; i++){
+        if (strcmp(argv[i],"-d") == 0 && i+1 < argc){
+            args.decoders = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i],"-t") == 0 && i+1 < argc){
+            args.tilers = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i],"-e") == 0 && i+1 < argc){
+            args.encoders = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i],"-q") == 0 && i+1 < argc){
+            args.depth = atoi(argv[++i]);
+        }
+        else if (!jobFile && argv[i][0] != '-'){
+            jobFile = argv[i];
+        }
+        else{
+            usage();
+            return -1;
+        }
+    }
+
+    // Open job list
+    if (jobFile){
+        in = fopen(jobFile,"r");
+        if (!in){
+            fprintf(stderr,"ERROR: Could not open %s.\n",jobFile);
+            return -1;
+        }
     }
-}
 
+    // Run jobs
+    failed = run_pipeline(in,stdout,args);
+    if (jobFile){
+        fclose(in);
+    }
+
+    return failed > 0 ? -1 : 0;
+}
 
 /*
  * This executes the main program with various inputs according
  * to the usage statement.
  */
 int main(int argc, char *argv[], char **envp){
-    int i;                    // Iterator
-    tile_args args;           // Tile arguments
-    FlagType flag = NONE;     // Flag type mapped in order
-    FlagType prevFlag = NONE; // Previously encountered flag
-    image_f imgIn;            // Input image
-    image_f imgOut;           // Output image
-    char *inFile;             // Input filename
-    char *outFile;            // Output filename
-
-    // Initial argument number check
-    if (argc < 3){
-        usage();
-        return -1;
+    int k;                    // Iterator
+    tile_job job;             // Tiling job
+    image_f imgIn[MAX_MAPS];  // Input images
+    image_f imgOut[MAX_MAPS]; // Output images
+
+    // Check for server mode
+    if (argc > 1 && strcmp(argv[1],"--serve") == 0){
+        return serve(argc-2,&argv[2]);
     }
 
-    // Set tile input, output files and default arguments
-    setDefaultArgs(&args);
-    inFile = argv[1];
-    outFile = argv[2];
-
-    // Parse arguments (skipping command name and files)
-    for (i=3; i<argc; i++){
-        // Get current flag type
-        flag = check_flag(argv[i]);
+    // Check for batch mode
+    if (argc > 1 && strcmp(argv[1],"--batch") == 0){
+        return batch(argc-2,&argv[2]);
+    }
 
-        // Only parse details if the previous flag is valid
-        if (prevFlag != NONE && flag == NONE){
-            parseArgs(&args,argv[i],prevFlag);
-        }
-        else if ((prevFlag != NONE && flag != NONE) || flag == HELP){
-            usage();
-            return -1;
-        }
-        prevFlag = flag;
+    // Parse arguments (skipping command name)
+    if (parse_job(&job,argc-1,&argv[1]) != 0){
+        usage();
+        return -1;
     }
 
-    // Read input file
-    imgIn = read_png(inFile);
+    // Read input files
+    for (k=0; k<job.numMaps; k++){
+        imgIn[k] = read_png(job.mapIn[k]);
+    }
+    if (check_octave(&job,imgIn[0].height,imgIn[0].width) != 0){
+        perror_("ERROR: Octave too large for the image size.");
+    }
 
     // Perform tiling operation
-    tileImage(&imgOut,&imgIn,args);
+    tileImages(imgOut,imgIn,job.numMaps,job.mapNormal,job.args);
 
-    // Write output
-    write_png(&imgOut,outFile,8);
+    // Write outputs
+    for (k=0; k<job.numMaps; k++){
+        write_png(&imgOut[k],job.mapOut[k],8);
+    }
 
     // Deallocate images
-    dealloc_image(&imgIn);
-    dealloc_image(&imgOut);
+    for (k=0; k<job.numMaps; k++){
+        dealloc_image(&imgIn[k]);
+        dealloc_image(&imgOut[k]);
+    }
 
     return 0;
 }
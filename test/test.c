@@ -6,14 +6,558 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include "image.h"
 #include "tile.h"
+#include "poisson.h"
+#include "job.h"
+#include "cache.h"
+
+// Wrapping macro definition
+#define wrp(x,y) (x%y>=0?x%y:y+x%y)
 
 /**** Image test suite ****/
 
+/*
+ * This fills an image with reproducible pseudo-random values.
+ *
+ * Inputs:
+ *     img - The image to fill (modified)
+ *     seed - The random seed
+ */
+static void randomImage(image_f *img, unsigned int seed){
+    int i; // Iterator
+    int n = (*img).height*(*img).width*(*img).depth;
 
+    srand(seed);
+    for (i=0; i<n; i++){
+        (*img).data[i] = (float)rand()/(float)RAND_MAX;
+    }
+}
 
+/*
+ * This checks whether two images are exactly equal.
+ *
+ * Inputs:
+ *     a - The first image
+ *     b - The second image
+ * Outputs:
+ *     equal - 1 if the images are identical, 0 otherwise
+ */
+static int sameImage(image_f *a, image_f *b){
+    if ((*a).height != (*b).height || (*a).width != (*b).width || (*a).depth != (*b).depth){
+        return 0;
+    }
+    return memcmp((*a).data,(*b).data,sizeof(float)*(*a).height*(*a).width*(*a).depth) == 0;
+}
 
 
 /**** Tile test suite ****/
 
+/*
+ * This accumulates every masked placement one placement and
+ * one tile pixel at a time, which is the reference for the
+ * cache blocked accumulation (see tileAccumulate).
+ *
+ * Inputs:
+ *     dsts - The unnormalized output images (modified)
+ *     acc - The accumulated mask weights (modified)
+ *     tiles - The scaled tiles
+ *     n - The number of tiles
+ *     height - The output image height
+ *     width - The output image width
+ *     args - Shaping arguments (see tileImage)
+ */
+static void naiveAccumulate(image_f *dsts, image_f *acc, image_f *tiles, int n, int height, int width, tile_args args){
+    tile_plan plan;  // Placement plan
+    int tH,tW;       // Tile heights and widths
+    int o,k,z,x,y;   // Iterators
+    int p,t;         // Output and tile coordinates
+    float m;         // Mask weight
+
+    tH = tiles[0].height; tW = tiles[0].width;
+    for (k=0; k<n; k++){
+        alloc_image(&dsts[k],height,width,tiles[k].depth);
+        image_fill(&dsts[k],0.0);
+        if (tiles[k].depth > 2){
+            image_fillChan(&dsts[k],args.bgColor.r,0);
+            image_fillChan(&dsts[k],args.bgColor.g,1);
+            image_fillChan(&dsts[k],args.bgColor.b,2);
+        }
+    }
+    alloc_image(acc,height,width,1);
+    image_fill(acc,0.0);
+
+    tilePlan(&plan,tH,tW,height,width,args);
+    for (o=0; o<plan.count; o++){
+        for (y=0; y<tH; y++){
+            for (x=0; x<tW; x++){
+                p = wrp((plan.yoff[o]+y),height)*width+wrp((plan.xoff[o]+x),width);
+                t = y*tW+x;
+                m = plan.mask.data[t];
+                (*acc).data[p] += m;
+                for (k=0; k<n; k++){
+                    for (z=0; z<tiles[k].depth; z++){
+                        dsts[k].data[z*height*width+p] += tiles[k].data[z*tH*tW+t]*m;
+                    }
+                }
+            }
+        }
+    }
+    freePlan(&plan);
+}
+
+/*
+ * This tests that the cache blocked accumulation (including
+ * the specialized span kernels) is bit identical to the
+ * reference accumulation for a range of output sizes, tile
+ * sizes (including tiles larger than the output), octaves and
+ * map depths.
+ *
+ * Outputs:
+ *     failed - The number of failed cases
+ */
+static int testBlockedAccumulate(){
+    // Cases of output height, width, tile height, width, octave and depths (0 ends)
+    static const int cases[][9] = {
+        {256,256,64,64,2,3,0,0,0},
+        {256,256,400,400,2,3,0,0,0},
+        {256,256,400,300,0,3,0,0,0},
+        {256,256,256,256,0,4,0,0,0},
+        {256,256,100,90,1,1,0,0,0},
+        {37,1100,20,600,3,3,1,0,0},
+        {300,200,1000,50,2,2,0,0,0},
+        {1024,700,300,260,2,3,3,1,4},
+    };
+    int numCases = sizeof(cases)/sizeof(cases[0]);
+    image_f tiles[3];  // Scaled tiles
+    image_f ref[3];    // Reference outputs
+    image_f out[3];    // Blocked outputs
+    image_f refAcc;    // Reference weights
+    image_f outAcc;    // Blocked weights
+    tile_args args;    // Shaping arguments
+    int c,k,n;         // Iterators and number of maps
+    int ok;            // Whether the case passed
+    int failed = 0;    // Number of failed cases
+
+    for (c=0; c<numCases; c++){
+        setDefaultArgs(&args);
+        args.pHeight = cases[c][2];
+        args.pWidth = cases[c][3];
+        args.octave = cases[c][4];
+        args.bgColor.r = 0.25; args.bgColor.g = 0.5; args.bgColor.b = 0.75;
+        for (n=0; n<3 && cases[c][5+n] > 0; n++){
+            alloc_image(&tiles[n],cases[c][2],cases[c][3],cases[c][5+n]);
+            randomImage(&tiles[n],c*3+n+1);
+        }
+
+        naiveAccumulate(ref,&refAcc,tiles,n,cases[c][0],cases[c][1],args);
+        tileAccumulate(out,&outAcc,tiles,n,cases[c][0],cases[c][1],args);
+        ok = sameImage(&refAcc,&outAcc);
+        for (k=0; k<n; k++){
+            ok = ok && sameImage(&ref[k],&out[k]);
+        }
+        if (!ok){
+            printf("    case %d (%dx%d, tile %dx%d, octave %d) differs\n",c,
+                   cases[c][0],cases[c][1],cases[c][2],cases[c][3],cases[c][4]);
+            failed++;
+        }
+
+        for (k=0; k<n; k++){
+            dealloc_image(&tiles[k]);
+            dealloc_image(&ref[k]);
+            dealloc_image(&out[k]);
+        }
+        dealloc_image(&refAcc);
+        dealloc_image(&outAcc);
+    }
+
+    return failed;
+}
+
+/*
+ * This tests multi-band blending at even, partly even and odd
+ * output sizes: constant images must stay constant, a ramp must
+ * wrap without a seam (its wrapped rows and columns differ no
+ * more than neighboring ones) and must not simply fall back to
+ * the average blend.
+ *
+ * Outputs:
+ *     failed - The number of failed cases
+ */
+static int testPyramidBlend(){
+    static const int sizes[][2] = {{256,256},{200,300},{301,299}};
+    int numSizes = sizeof(sizes)/sizeof(sizes[0]);
+    image_f src;       // Input image
+    image_f dst;       // Pyramid blended output
+    image_f avg;       // Average blended output
+    tile_args args;    // Shaping arguments
+    int h,w,n;         // Boundaries
+    int s,z,x,y,i;     // Iterators
+    float err;         // Largest error of the constant image
+    float edge,inner;  // Largest wrapped and neighboring differences
+    float v;           // Current difference
+    double diff;       // Mean difference from the average blend
+    int failed = 0;    // Number of failed cases
+
+    for (s=0; s<numSizes; s++){
+        h = sizes[s][0]; w = sizes[s][1]; n = h*w;
+        setDefaultArgs(&args);
+        args.blend = BLEND_PYRAMID;
+
+        // Constant image
+        alloc_image(&src,h,w,3);
+        image_fillChan(&src,0.2,0);
+        image_fillChan(&src,0.5,1);
+        image_fillChan(&src,0.7,2);
+        tileImage(&dst,&src,args);
+        err = 0;
+        for (z=0; z<3; z++){
+            for (i=0; i<n; i++){
+                err = fmax(err,fabs(dst.data[z*n+i]-src.data[z*n]));
+            }
+        }
+        dealloc_image(&dst);
+
+        // Ramp image (tiles do not wrap on their own)
+        for (z=0; z<3; z++){
+            for (y=0; y<h; y++){
+                for (x=0; x<w; x++){
+                    src.data[z*n+y*w+x] = 0.1+0.8*(z == 1 ? (float)y/h : (float)x/w);
+                }
+            }
+        }
+        tileImage(&dst,&src,args);
+        args.blend = BLEND_AVERAGE;
+        tileImage(&avg,&src,args);
+        edge = 0; inner = 0; diff = 0;
+        for (z=0; z<3; z++){
+            for (y=0; y<h; y++){
+                for (x=0; x<w; x++){
+                    i = z*n+y*w+x;
+                    v = fabs(dst.data[i]-dst.data[z*n+((y+1)%h)*w+x]);
+                    if (y+1 < h){
+                        inner = fmax(inner,v);
+                    }
+                    else{
+                        edge = fmax(edge,v);
+                    }
+                    v = fabs(dst.data[i]-dst.data[z*n+y*w+(x+1)%w]);
+                    if (x+1 < w){
+                        inner = fmax(inner,v);
+                    }
+                    else{
+                        edge = fmax(edge,v);
+                    }
+                    diff += fabs(dst.data[i]-avg.data[i]);
+                }
+            }
+        }
+        diff /= 3*n;
+
+        if (err > 1e-4 || edge > 2*inner || !(diff >= 1e-3)){
+            printf("    %dx%d: constant error %f, wrap %f (inside %f), difference from average %f\n",
+                   h,w,err,edge,inner,diff);
+            failed++;
+        }
+
+        dealloc_image(&src);
+        dealloc_image(&dst);
+        dealloc_image(&avg);
+    }
+
+    return failed;
+}
+
+/*
+ * This tests that the Poisson solver recovers a known periodic
+ * image from its discrete Laplacian (up to a constant) for
+ * even, odd, prime and very unequal sizes.
+ *
+ * Outputs:
+ *     failed - The number of failed sizes
+ */
+static int testPoissonSolve(){
+    static const int sizes[][2] = {{512,512},{600,720},{1023,1023},{1021,1021},{37,1100},{31,33}};
+    int numSizes = sizeof(sizes)/sizeof(sizes[0]);
+    image_f u,f,g;     // Solution, right hand side and known image
+    int h,w;           // Boundaries
+    int s,x,y,i;       // Iterators
+    double mu,mg;      // Solution and known image means
+    float err;         // Largest error
+    int failed = 0;    // Number of failed sizes
+
+    for (s=0; s<numSizes; s++){
+        h = sizes[s][0]; w = sizes[s][1];
+        alloc_image(&u,h,w,1);
+        alloc_image(&f,h,w,1);
+        alloc_image(&g,h,w,1);
+        for (y=0; y<h; y++){
+            for (x=0; x<w; x++){
+                g.data[y*w+x] = sin(2*M_PI*3*x/w)*cos(2*M_PI*2*y/h)+0.3*sin(2*M_PI*(x+y)/w);
+            }
+        }
+        for (y=0; y<h; y++){
+            for (x=0; x<w; x++){
+                f.data[y*w+x] = g.data[wrp((y+1),h)*w+x]+g.data[wrp((y-1),h)*w+x]+
+                                g.data[y*w+wrp((x+1),w)]+g.data[y*w+wrp((x-1),w)]-4*g.data[y*w+x];
+            }
+        }
+        image_fill(&u,0.0);
+        poisson_solve(&u,&f);
+
+        mu = 0; mg = 0;
+        for (i=0; i<h*w; i++){
+            mu += u.data[i];
+            mg += g.data[i];
+        }
+        mu /= h*w; mg /= h*w;
+        err = 0;
+        for (i=0; i<h*w; i++){
+            err = fmax(err,fabs((u.data[i]-mu)-(g.data[i]-mg)));
+        }
+        if (err > 2e-3){
+            printf("    %dx%d is off by %f\n",h,w,err);
+            failed++;
+        }
+
+        dealloc_image(&u);
+        dealloc_image(&f);
+        dealloc_image(&g);
+    }
+
+    return failed;
+}
+
+/*
+ * This tests that gradient-domain blending leaves constant
+ * images unchanged (they have no gradients), at a size where
+ * summing a plane in single precision loses the mean.
+ *
+ * Outputs:
+ *     failed - The number of failed channels
+ */
+static int testPoissonConstant(){
+    static const float values[] = {0.2,0.5,180.0/255.0};
+    image_f src;       // Constant input
+    image_f dst;       // Blended output
+    tile_args args;    // Shaping arguments
+    int z,i;           // Iterators
+    int n = 2048*2048; // Plane size
+    float err;         // Largest error of a channel
+    int failed = 0;    // Number of failed channels
+
+    alloc_image(&src,2048,2048,3);
+    for (z=0; z<3; z++){
+        image_fillChan(&src,values[z],z);
+    }
+    setDefaultArgs(&args);
+    args.blend = BLEND_POISSON;
+    tileImage(&dst,&src,args);
+
+    for (z=0; z<3; z++){
+        err = 0;
+        for (i=0; i<n; i++){
+            err = fmax(err,fabs(dst.data[z*n+i]-values[z]));
+        }
+        if (err > 1.0/512.0){
+            printf("    channel %d is off by %f\n",z,err);
+            failed++;
+        }
+    }
+
+    dealloc_image(&src);
+    dealloc_image(&dst);
+
+    return failed;
+}
+
+
+/**** Job test suite ****/
+
+/*
+ * This tests that blending methods are parsed and that
+ * unknown ones make the job invalid.
+ *
+ * Outputs:
+ *     failed - The number of failed cases
+ */
+static int testParseBlend(){
+    static const char *methods[] = {"average","pyramid","poisson","pyrmid",""};
+    static const int expected[] = {BLEND_AVERAGE,BLEND_PYRAMID,BLEND_POISSON,-1,-1};
+    char *argv[4] = {"in.png","out.png","-b",NULL}; // Job arguments
+    tile_job job;   // Parsed job
+    int i,ret;      // Iterator and parse result
+    int failed = 0; // Number of failed cases
+
+    for (i=0; i<5; i++){
+        argv[3] = (char*)methods[i];
+        ret = parse_job(&job,4,argv);
+        if (expected[i] < 0 ? ret == 0 : (ret != 0 || (int)job.args.blend != expected[i])){
+            printf("    \"-b %s\" parsed incorrectly\n",methods[i]);
+            failed++;
+        }
+    }
+
+    return failed;
+}
+
+/*
+ * This tests that jobs with negative or overflowing octaves
+ * are rejected when parsed and that octaves which leave empty
+ * placement cells are rejected once the input size is known.
+ *
+ * Outputs:
+ *     failed - The number of failed cases
+ */
+static int testParseOctave(){
+    static const char *octaves[] = {"0","15","-1","16"};
+    static const int valid[] = {1,1,0,0};
+    char *argv[4] = {"in.png","out.png","-o",NULL}; // Job arguments
+    tile_job job;   // Parsed job
+    int i,ret;      // Iterator and parse result
+    int failed = 0; // Number of failed cases
+
+    for (i=0; i<4; i++){
+        argv[3] = (char*)octaves[i];
+        ret = parse_job(&job,4,argv);
+        if ((ret == 0) != valid[i]){
+            printf("    \"-o %s\" parsed incorrectly\n",octaves[i]);
+            failed++;
+        }
+    }
+
+    argv[3] = "4";
+    parse_job(&job,4,argv);
+    if (check_octave(&job,16,4096) != 0 || check_octave(&job,15,4096) == 0){
+        printf("    octave 4 checked incorrectly against 16 and 15 pixels\n");
+        failed++;
+    }
+
+    return failed;
+}
+
+
+/**** Cache test suite ****/
+
+/*
+ * This inserts a small source image into a cache and releases
+ * it.
+ *
+ * Inputs:
+ *     cache - The cache (modified)
+ *     hash - The source hash
+ */
+static void cachePut(image_cache *cache, unsigned long long hash){
+    image_f img;  // Cached image (owned by the cache)
+
+    alloc_image(&img,8,8,1);
+    cache_release(cache,cache_put(cache,CACHE_SOURCE,hash,0,0,img));
+}
+
+/*
+ * This checks whether a source is cached, releasing it if so.
+ *
+ * Inputs:
+ *     cache - The cache (modified)
+ *     hash - The source hash
+ * Outputs:
+ *     found - 1 if the source is cached, 0 otherwise
+ */
+static int cacheHas(image_cache *cache, unsigned long long hash){
+    image_f *img = cache_get(cache,CACHE_SOURCE,hash,0,0);
+
+    if (img){
+        cache_release(cache,img);
+    }
+    return img != NULL;
+}
+
+/*
+ * This tests the cache hit and miss counts, that the least
+ * recently used entry is evicted first and that entries in
+ * use are never evicted.
+ *
+ * Outputs:
+ *     failed - The number of failed checks
+ */
+static int testCache(){
+    image_cache cache;  // Cache holding three 8x8 sources
+    image_f *pinned;    // Source kept in use
+    int failed = 0;     // Number of failed checks
+
+    cache_init(&cache,3*sizeof(float)*8*8);
+    cachePut(&cache,1);
+    cachePut(&cache,2);
+    cachePut(&cache,3);
+
+    // Using 1 leaves 2 least recently used
+    failed += !cacheHas(&cache,1);
+    cachePut(&cache,4);
+    failed += cache.evictions != 1;
+    failed += cacheHas(&cache,2);
+    failed += !cacheHas(&cache,3) || !cacheHas(&cache,4) || !cacheHas(&cache,1);
+
+    // Tiles of a cached source are separate entries
+    failed += cache_get(&cache,CACHE_TILE,1,8,8) != NULL;
+
+    // The pinned 3 is least recently used but 4 is evicted instead
+    pinned = cache_get(&cache,CACHE_SOURCE,3,0,0);
+    failed += pinned == NULL;
+    failed += !cacheHas(&cache,4) || !cacheHas(&cache,1);
+    cachePut(&cache,5);
+    failed += cache.evictions != 2;
+    cache_release(&cache,pinned);
+    failed += !cacheHas(&cache,3) || cacheHas(&cache,4);
+
+    // Hits and misses of every lookup above
+    failed += cache.hits[CACHE_SOURCE] != 8 || cache.misses[CACHE_SOURCE] != 2;
+    failed += cache.hits[CACHE_TILE] != 0 || cache.misses[CACHE_TILE] != 1;
+    if (failed){
+        printf("    %d checks failed\n",failed);
+    }
+
+    cache_destroy(&cache);
+    return failed;
+}
+
+
+/*
+ * This runs every test and reports the results.
+ */
+int main(int argc, char *argv[]){
+    int failed = 0; // Number of failed tests
+    int f;          // Failures of the current test
+
+    f = testBlockedAccumulate();
+    printf("%s blocked accumulation\n",f ? "FAIL" : "PASS");
+    failed += f > 0;
+
+    f = testPyramidBlend();
+    printf("%s pyramid blending\n",f ? "FAIL" : "PASS");
+    failed += f > 0;
+
+    f = testPoissonSolve();
+    printf("%s poisson solver\n",f ? "FAIL" : "PASS");
+    failed += f > 0;
+
+    f = testPoissonConstant();
+    printf("%s poisson constant image\n",f ? "FAIL" : "PASS");
+    failed += f > 0;
+
+    f = testParseBlend();
+    printf("%s blend parsing\n",f ? "FAIL" : "PASS");
+    failed += f > 0;
+
+    f = testParseOctave();
+    printf("%s octave parsing\n",f ? "FAIL" : "PASS");
+    failed += f > 0;
+
+    f = testCache();
+    printf("%s cache eviction\n",f ? "FAIL" : "PASS");
+    failed += f > 0;
+
+    return failed > 0 ? 1 : 0;
+}